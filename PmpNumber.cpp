@@ -4,9 +4,249 @@
 /////////////////////////////////////////////////////////////////////////////
 
 #include "stdafx.h"
+#include <future>       // for std::async
+#include <climits>      // for CHAR_BIT
+#include <cstring>      // for std::memcpy
+#include <cstdlib>      // for std::atol, std::strtod
+#include <cctype>       // for std::isdigit
+#include <limits>       // for std::numeric_limits
+#include <list>         // for std::list
+#include <mutex>        // for std::mutex
+#include <unordered_map> // for std::unordered_map
+#include <boost/version.hpp>
+#include <boost/cstdint.hpp>
+#if BOOST_VERSION >= 106000
+    #include <boost/serialization/nvp.hpp>
+#endif
+
+#if defined(_MSC_VER)
+    #define PMP_THREAD_LOCAL    __declspec(thread)
+#else
+    #define PMP_THREAD_LOCAL    __thread
+#endif
 
 namespace pmp
 {
+    //
+    // allocation
+    //
+    // Every block starts with a header holding its size class and the
+    // arena it came from, if any.  Classes are multiples of s_pool_align
+    // up to s_pool_max_size; larger blocks go straight to operator new.
+    // A thread keeps at most s_pool_keep free blocks per class, wherever
+    // they were allocated.
+    //
+    static const size_t s_pool_align = 16;
+    static const size_t s_pool_max_size = 512;
+    static const size_t s_pool_classes = s_pool_max_size / s_pool_align;
+    static const size_t s_pool_keep = 256;
+    static const size_t s_pool_large = 0;
+
+    union PoolHeader
+    {
+        struct
+        {
+            size_t  m_class;
+            Arena * m_arena;
+        } m;
+        char    m_pad[s_pool_align];
+    };
+
+    struct PoolFree
+    {
+        PoolFree *m_next;
+    };
+
+    struct Arena::Free : PoolFree
+    {
+    };
+
+    static PMP_THREAD_LOCAL PoolFree *s_pool_free[s_pool_classes + 1];
+    static PMP_THREAD_LOCAL size_t s_pool_count[s_pool_classes + 1];
+    static PMP_THREAD_LOCAL bool s_pool_used;
+    static PMP_THREAD_LOCAL Arena *s_arena;
+
+    static void pool_release()
+    {
+        for (size_t klass = 1; klass <= s_pool_classes; ++klass)
+        {
+            while (PoolFree *block = s_pool_free[klass])
+            {
+                s_pool_free[klass] = block->m_next;
+                ::operator delete(block);
+            }
+            s_pool_count[klass] = 0;
+        }
+    }
+
+#if !defined(_MSC_VER) || _MSC_VER >= 1900
+    // gives the free blocks back when the thread exits; Visual C++ 2013
+    // has no thread_local, so there they stay with the thread
+    struct PoolRelease
+    {
+        ~PoolRelease()
+        {
+            pool_release();
+        }
+    };
+    static thread_local PoolRelease s_pool_release;
+
+    static inline void pool_release_at_exit()
+    {
+        static_cast<void>(&s_pool_release);
+    }
+#else
+    static inline void pool_release_at_exit()
+    {
+    }
+#endif
+
+    void *pool_allocate(size_t size)
+    {
+        size_t klass = (size + s_pool_align - 1) / s_pool_align;
+        if (klass == 0)
+            klass = 1;
+
+        PoolHeader *header;
+        Arena *arena = s_arena;
+        if (arena)
+        {
+            if (klass <= s_pool_classes && arena->m_free[klass])
+            {
+                Arena::Free *block = arena->m_free[klass];
+                arena->m_free[klass] = static_cast<Arena::Free *>(block->m_next);
+                header = reinterpret_cast<PoolHeader *>(block);
+            }
+            else
+            {
+                header = static_cast<PoolHeader *>(
+                    arena->allocate(sizeof(PoolHeader) + klass * s_pool_align));
+            }
+            header->m.m_class = (klass <= s_pool_classes ? klass : s_pool_large);
+        }
+        else if (klass <= s_pool_classes)
+        {
+            PoolFree *block = s_pool_free[klass];
+            if (block)
+            {
+                s_pool_free[klass] = block->m_next;
+                --s_pool_count[klass];
+                header = reinterpret_cast<PoolHeader *>(block);
+            }
+            else
+            {
+                header = static_cast<PoolHeader *>(
+                    ::operator new(sizeof(PoolHeader) + klass * s_pool_align));
+            }
+            header->m.m_class = klass;
+        }
+        else
+        {
+            header = static_cast<PoolHeader *>(
+                ::operator new(sizeof(PoolHeader) + size));
+            header->m.m_class = s_pool_large;
+        }
+        header->m.m_arena = arena;
+        return header + 1;
+    }
+
+    void pool_deallocate(void *p)
+    {
+        if (p == NULL)
+            return;
+
+        PoolHeader *header = static_cast<PoolHeader *>(p) - 1;
+        size_t klass = header->m.m_class;
+        if (Arena *arena = header->m.m_arena)
+        {
+            // only the current arena reuses its blocks; the rest go with
+            // their arena
+            if (arena == s_arena && klass != s_pool_large)
+            {
+                Arena::Free *block = reinterpret_cast<Arena::Free *>(header);
+                block->m_next = arena->m_free[klass];
+                arena->m_free[klass] = block;
+            }
+            return;
+        }
+        if (klass == s_pool_large || s_pool_count[klass] >= s_pool_keep)
+        {
+            ::operator delete(header);
+            return;
+        }
+        if (!s_pool_used)
+        {
+            pool_release_at_exit();
+            s_pool_used = true;
+        }
+        PoolFree *block = reinterpret_cast<PoolFree *>(header);
+        block->m_next = s_pool_free[klass];
+        s_pool_free[klass] = block;
+        ++s_pool_count[klass];
+    }
+
+    struct Arena::Chunk
+    {
+        Chunk *     m_next;
+        char        m_pad[s_pool_align - sizeof(Chunk *)];
+    };
+
+    Arena::Arena(size_t chunk_size/* = 64 * 1024*/) :
+        m_outer(s_arena), m_chunks(NULL), m_chunk_size(chunk_size),
+        m_next(NULL), m_end(NULL), m_used(0)
+    {
+        static_assert(s_free_lists == s_pool_classes + 1, "size classes");
+        std::fill(m_free, m_free + s_free_lists, static_cast<Free *>(NULL));
+        s_arena = this;
+    }
+
+    Arena::~Arena()
+    {
+        assert(s_arena == this);
+        s_arena = m_outer;
+        while (m_chunks)
+        {
+            Chunk *next = m_chunks->m_next;
+            ::operator delete(m_chunks);
+            m_chunks = next;
+        }
+    }
+
+    Arena *Arena::current()
+    {
+        return s_arena;
+    }
+
+    void *Arena::allocate(size_t size)
+    {
+        size = (size + s_pool_align - 1) / s_pool_align * s_pool_align;
+        if (static_cast<size_t>(m_end - m_next) < size)
+        {
+            // a block larger than a chunk gets a chunk of its own
+            size_t bytes = (size > m_chunk_size ? size : m_chunk_size);
+            Chunk *chunk = static_cast<Chunk *>(
+                ::operator new(sizeof(Chunk) + bytes));
+            chunk->m_next = m_chunks;
+            m_chunks = chunk;
+            m_next = reinterpret_cast<char *>(chunk + 1);
+            m_end = m_next + bytes;
+        }
+        void *p = m_next;
+        m_next += size;
+        m_used += size;
+        return p;
+    }
+
+    Arena::Suspend::Suspend() : m_arena(s_arena)
+    {
+        s_arena = NULL;
+    }
+
+    Arena::Suspend::~Suspend()
+    {
+        s_arena = m_arena;
+    }
+
     #ifdef PMP_INTDIV_INTEGER
         static const Number::Type s_intdiv_type = Number::INTEGER;
     #elif defined(PMP_INTDIV_FLOATING)
@@ -22,589 +262,4136 @@ namespace pmp
             return old_type;
         }
     #endif
+
+    static bool s_lazy_rational = false;
+    static size_t s_lazy_rational_bits = 2048;
+
+    bool SetLazyRational(bool enable)
+    {
+        bool old_enable = s_lazy_rational;
+        s_lazy_rational = enable;
+        return old_enable;
+    }
+
+    size_t SetLazyRationalThreshold(size_t bits)
+    {
+        size_t old_bits = s_lazy_rational_bits;
+        s_lazy_rational_bits = bits;
+        return old_bits;
+    }
+
+    static bool s_auto_demote = false;
+
+    bool SetAutoDemote(bool enable)
+    {
+        bool old_enable = s_auto_demote;
+        s_auto_demote = enable;
+        return old_enable;
+    }
+
+    //
+    // interned values
+    //
+    // The table is built on first use and installed with a compare and
+    // swap, like the series tables.  It is never freed.
+    //
+    std::atomic<Number::Inner * const *> Number::s_interned;
+
+    Number::Inner * const *Number::interned()
+    {
+        Inner * const *table = s_interned.load(std::memory_order_acquire);
+        if (table)
+            return table;
+
+        Arena::Suspend suspend;
+        const int count = s_interned_max - s_interned_min + 1;
+        Inner **mine = new Inner *[count + 2];
+        for (int i = 0; i < count; ++i)
+            mine[i] = Inner::create<integer_type>(INTEGER, i + s_interned_min);
+        mine[count] = Inner::create<floating_type>(FLOATING, 0.0);
+        mine[count + 1] = Inner::create<floating_type>(FLOATING, 1.0);
+        for (int i = 0; i < count + 2; ++i)
+            mine[i]->m_interned = true;
+
+        if (s_interned.compare_exchange_strong(table, mine,
+                                               std::memory_order_acq_rel))
+        {
+            return mine;
+        }
+        for (int i = 0; i < count + 2; ++i)
+            Inner::destroy(mine[i]);
+        delete[] mine;
+        return table;
+    }
+
+    static inline size_t bit_size(const integer_type& i)
+    {
+        return i.backend().size() * sizeof(b_mp::limb_type) * CHAR_BIT;
+    }
+
+    static lazy_rational lazy_add(const lazy_rational& a, const lazy_rational& b)
+    {
+        if (a.den == b.den)
+            return lazy_rational(a.num + b.num, a.den);
+        lazy_rational q(i_mul(a.num, b.den), i_mul(a.den, b.den));
+        q.num += i_mul(b.num, a.den);
+        return q;
+    }
+
+    static lazy_rational lazy_sub(const lazy_rational& a, const lazy_rational& b)
+    {
+        if (a.den == b.den)
+            return lazy_rational(a.num - b.num, a.den);
+        lazy_rational q(i_mul(a.num, b.den), i_mul(a.den, b.den));
+        q.num -= i_mul(b.num, a.den);
+        return q;
+    }
+
+    static lazy_rational lazy_mul(const lazy_rational& a, const lazy_rational& b)
+    {
+        return lazy_rational(i_mul(a.num, b.num), i_mul(a.den, b.den));
+    }
+
+    static lazy_rational lazy_div(const lazy_rational& a, const lazy_rational& b)
+    {
+        assert(!b.num.is_zero());
+        lazy_rational q(i_mul(a.num, b.den), i_mul(a.den, b.num));
+        if (q.den.sign() < 0)
+        {
+            q.num = -q.num;
+            q.den = -q.den;
+        }
+        return q;
+    }
 }
 
 /////////////////////////////////////////////////////////////////////////////
+// multiplication engine
 
 namespace pmp
 {
-    Number::Number(Type type, const std::string& str) :
-        m_inner(boost::shared_ptr<Inner>(new Inner(type, str)))
+    typedef b_mp::limb_type limb_type;
+    static const size_t s_limb_bits = sizeof(limb_type) * CHAR_BIT;
+
+    // Crossovers measured with 64-bit limbs.  Boost 1.73 and later do
+    // Karatsuba inside cpp_int, which then stays ahead of our Karatsuba
+    // and Toom-3 until the transform takes over.
+#if BOOST_VERSION >= 107300
+    static MulThresholds s_mul_thresholds = { 0, 24000, 24000 };
+#else
+    static MulThresholds s_mul_thresholds = { 80, 2000, 24000 };
+#endif
+
+    MulThresholds SetMulThresholds(const MulThresholds& thresholds)
     {
+        MulThresholds old_thresholds = s_mul_thresholds;
+        s_mul_thresholds = thresholds;
+        return old_thresholds;
     }
 
-    Number::Number(const std::string& str)
+    MulThresholds GetMulThresholds()
     {
-#ifndef PMP_DISABLE_VECTOR
-        if (str.find(',') != std::string::npos)
+        return s_mul_thresholds;
+    }
+
+    static inline size_t limb_count(const integer_type& i)
+    {
+        return i.backend().size();
+    }
+
+    static inline bool tier_on(size_t n, size_t threshold)
+    {
+        return threshold != 0 && n >= threshold;
+    }
+
+    // result = |i| limbs [first, first + count)
+    static void get_limbs(integer_type& result, const integer_type& i,
+                          size_t first, size_t count)
+    {
+        size_t n = limb_count(i);
+        if (first >= n)
+        {
+            result = 0;
+            return;
+        }
+        if (count > n - first)
+            count = n - first;
+        const limb_type *p = i.backend().limbs() + first;
+        while (count > 0 && p[count - 1] == 0)
+            --count;
+        if (count == 0)
         {
-            m_inner = boost::shared_ptr<Inner>(new Inner(VECTOR, str));
+            result = 0;
+            return;
+        }
+        result.backend().resize(static_cast<unsigned>(count),
+                                static_cast<unsigned>(count));
+        std::memcpy(result.backend().limbs(), p, count * sizeof(limb_type));
+        result.backend().sign(false);
+        result.backend().normalize();
+    }
+
+    static void mul_magnitude(integer_type& result, const integer_type& a,
+                              const integer_type& b, bool square);
+
+    static void mul_karatsuba(integer_type& result, const integer_type& a,
+                              const integer_type& b, bool square)
+    {
+        size_t k = (std::max(limb_count(a), limb_count(b)) + 1) / 2;
+        unsigned shift = static_cast<unsigned>(k * s_limb_bits);
+        integer_type a0, a1, b0, b1, z0, z1, z2;
+        get_limbs(a0, a, 0, k);
+        get_limbs(a1, a, k, limb_count(a));
+        if (square)
+        {
+            i_sqr(z0, a0);
+            i_sqr(z2, a1);
+            a0 += a1;
+            i_sqr(z1, a0);
         }
         else
-#endif
-        if (str.find('.')  != std::string::npos ||
-            str.find("e+") != std::string::npos ||
-            str.find("e-") != std::string::npos)
         {
-            m_inner = boost::shared_ptr<Inner>(new Inner(FLOATING, str));
+            get_limbs(b0, b, 0, k);
+            get_limbs(b1, b, k, limb_count(b));
+            i_mul(z0, a0, b0);
+            i_mul(z2, a1, b1);
+            a0 += a1;
+            b0 += b1;
+            i_mul(z1, a0, b0);
         }
-        else if (str.find("/") != std::string::npos)
+        z1 -= z0;
+        z1 -= z2;
+
+        result = z2;
+        result <<= shift;
+        result += z1;
+        result <<= shift;
+        result += z0;
+    }
+
+    // Toom-3 with the evaluation points 0, 1, -1, -2 and infinity and
+    // Bodrato's interpolation sequence
+    static void toom3_split(const integer_type& a, size_t k,
+                            integer_type& a0, integer_type& a2,
+                            integer_type& a1v, integer_type& am1,
+                            integer_type& am2)
+    {
+        integer_type a1;
+        get_limbs(a0, a, 0, k);
+        get_limbs(a1, a, k, k);
+        get_limbs(a2, a, 2 * k, limb_count(a));
+        integer_type p = a0 + a2;
+        a1v = p + a1;
+        am1 = p - a1;
+        am2 = am1 + a2;
+        am2 <<= 1;
+        am2 -= a0;
+    }
+
+    static void mul_toom3(integer_type& result, const integer_type& a,
+                          const integer_type& b, bool square)
+    {
+        size_t k = (std::max(limb_count(a), limb_count(b)) + 2) / 3;
+        unsigned shift = static_cast<unsigned>(k * s_limb_bits);
+        integer_type a0, a2, a1v, am1, am2;
+        integer_type r0, r1, rm1, rm2, rinf;
+        toom3_split(a, k, a0, a2, a1v, am1, am2);
+        if (square)
         {
-            m_inner = boost::shared_ptr<Inner>(new Inner(RATIONAL, str));
+            i_sqr(r0, a0);
+            i_sqr(r1, a1v);
+            i_sqr(rm1, am1);
+            i_sqr(rm2, am2);
+            i_sqr(rinf, a2);
         }
         else
         {
-            m_inner = boost::shared_ptr<Inner>(new Inner(INTEGER, str));
+            integer_type b0, b2, b1v, bm1, bm2;
+            toom3_split(b, k, b0, b2, b1v, bm1, bm2);
+            i_mul(r0, a0, b0);
+            i_mul(r1, a1v, b1v);
+            i_mul(rm1, am1, bm1);
+            i_mul(rm2, am2, bm2);
+            i_mul(rinf, a2, b2);
         }
+
+        integer_type c1, c2, c3;
+        c3 = rm2 - r1;
+        c3 /= 3;
+        c1 = r1 - rm1;
+        c1 /= 2;
+        c2 = rm1 - r0;
+        c3 = c2 - c3;
+        c3 /= 2;
+        c3 += rinf;
+        c3 += rinf;
+        c2 += c1;
+        c2 -= rinf;
+        c1 -= c3;
+
+        result = rinf;
+        result <<= shift;
+        result += c3;
+        result <<= shift;
+        result += c2;
+        result <<= shift;
+        result += c1;
+        result <<= shift;
+        result += r0;
     }
 
-    Number& Number::operator+=(const Number& num)
+    // number-theoretic transform over three primes with the primitive
+    // root 3; digits are 16 bits wide, so every convolution fits in the
+    // product of the primes
+    typedef boost::uint32_t ntt_word;
+    typedef boost::uint64_t ntt_dword;
+    static const ntt_word s_ntt_prime0 = 998244353;
+    static const ntt_word s_ntt_prime1 = 167772161;
+    static const ntt_word s_ntt_prime2 = 469762049;
+    static const size_t s_ntt_max_size = size_t(1) << 23;
+    static const size_t s_ntt_digits_per_limb = s_limb_bits / 16;
+
+    static ntt_word ntt_pow(ntt_dword base, ntt_dword e, ntt_word p)
     {
-#ifndef PMP_DISABLE_VECTOR
-        if (is_v() || num.is_v())
+        ntt_dword r = 1;
+        base %= p;
+        while (e)
         {
-            vector_type vec;
-            for (size_t i = 0; i < size(); ++i)
+            if (e & 1)
+                r = r * base % p;
+            base = base * base % p;
+            e >>= 1;
+        }
+        return static_cast<ntt_word>(r);
+    }
+
+    // the prime is a template argument so that the compiler can replace
+    // the divisions by multiplications
+    template <ntt_word p>
+    static void ntt_transform(std::vector<ntt_word>& a, bool invert)
+    {
+        size_t n = a.size();
+        for (size_t i = 1, j = 0; i < n; ++i)
+        {
+            size_t bit = n >> 1;
+            for (; j & bit; bit >>= 1)
+                j ^= bit;
+            j ^= bit;
+            if (i < j)
+                std::swap(a[i], a[j]);
+        }
+
+        std::vector<ntt_word> twiddle;
+        for (size_t len = 2; len <= n; len <<= 1)
+        {
+            size_t half = len / 2;
+            ntt_word w = ntt_pow(3, (p - 1) / len, p);
+            if (invert)
+                w = ntt_pow(w, p - 2, p);
+            twiddle.resize(half);
+            twiddle[0] = 1;
+            for (size_t j = 1; j < half; ++j)
+                twiddle[j] = static_cast<ntt_word>(ntt_dword(twiddle[j - 1]) * w % p);
+
+            for (size_t i = 0; i < n; i += len)
             {
-                for (size_t j = 0; j < num.size(); ++j)
+                for (size_t j = 0; j < half; ++j)
                 {
-                    Number tmp((*this)[i]);
-                    tmp += num[j];
-                    vec.push_back(tmp);
+                    ntt_word u = a[i + j];
+                    ntt_word v = static_cast<ntt_word>(
+                        ntt_dword(a[i + j + half]) * twiddle[j] % p);
+                    a[i + j] = (u + v >= p) ? u + v - p : u + v;
+                    a[i + j + half] = (u >= v) ? u - v : u + p - v;
                 }
             }
-            assign(vec);
-            return *this;
         }
-#endif  // ndef PMP_DISABLE_VECTOR
-        integer_type    i;
-        floating_type   f;
-        rational_type   r;
-        switch (type())
-        {
-        case Number::INTEGER:
-            switch (num.type())
-            {
-            case Number::INTEGER:
-                i = get_i();
-                i += num.get_i();
-                assign(i);
-                break;
-
-            case Number::FLOATING:
-                f = to_f();
-                f += num.get_f();
-                assign(f);
-                break;
 
-            case Number::RATIONAL:
-                r = to_r();
-                r += num.get_r();
-                assign(r);
-                break;
+        if (invert)
+        {
+            ntt_dword inv_n = ntt_pow(n, p - 2, p);
+            for (size_t i = 0; i < n; ++i)
+                a[i] = static_cast<ntt_word>(a[i] * inv_n % p);
+        }
+    }
 
-            default:
-                assert(0);
-                break;
+    static void ntt_digits(std::vector<ntt_word>& digits, const integer_type& i,
+                           size_t n)
+    {
+        digits.assign(n, 0);
+        const limb_type *p = i.backend().limbs();
+        for (size_t k = 0; k < limb_count(i); ++k)
+        {
+            limb_type limb = p[k];
+            for (size_t j = 0; j < s_ntt_digits_per_limb; ++j)
+            {
+                digits[k * s_ntt_digits_per_limb + j] =
+                    static_cast<ntt_word>(limb & 0xFFFF);
+                limb >>= 16;
             }
-            break;
+        }
+    }
 
-        case Number::FLOATING:
-            switch (num.type())
-            {
-            case Number::INTEGER:
-                f = get_f();
-                f += num.to_f();
-                assign(f);
-                break;
+    // cyclic convolution of the digits of a and b modulo p
+    template <ntt_word p>
+    static void ntt_convolve(std::vector<ntt_word>& fa, const integer_type& a,
+                             const integer_type& b, size_t n, bool square)
+    {
+        ntt_digits(fa, a, n);
+        ntt_transform<p>(fa, false);
+        if (square)
+        {
+            for (size_t i = 0; i < n; ++i)
+                fa[i] = static_cast<ntt_word>(ntt_dword(fa[i]) * fa[i] % p);
+        }
+        else
+        {
+            std::vector<ntt_word> fb;
+            ntt_digits(fb, b, n);
+            ntt_transform<p>(fb, false);
+            for (size_t i = 0; i < n; ++i)
+                fa[i] = static_cast<ntt_word>(ntt_dword(fa[i]) * fb[i] % p);
+        }
+        ntt_transform<p>(fa, true);
+    }
 
-            case Number::FLOATING:
-                f = get_f();
-                f += num.get_f();
-                assign(f);
-                break;
+    static bool ntt_fits(const integer_type& a, const integer_type& b)
+    {
+        size_t need = (limb_count(a) + limb_count(b)) * s_ntt_digits_per_limb;
+        return need <= s_ntt_max_size;
+    }
 
-            case Number::RATIONAL:
-                f = get_f();
-                f += num.to_f();
-                assign(f);
-                break;
+    static void mul_ntt(integer_type& result, const integer_type& a,
+                        const integer_type& b, bool square)
+    {
+        size_t need = (limb_count(a) + limb_count(b)) * s_ntt_digits_per_limb;
+        size_t n = 1;
+        while (n < need)
+            n <<= 1;
+
+        std::vector<ntt_word> residues[3];
+        ntt_convolve<s_ntt_prime0>(residues[0], a, b, n, square);
+        ntt_convolve<s_ntt_prime1>(residues[1], a, b, n, square);
+        ntt_convolve<s_ntt_prime2>(residues[2], a, b, n, square);
+
+        // Garner's algorithm; every coefficient is split into 16-bit pieces
+        // and accumulated, the carries are propagated afterwards
+        const ntt_word p0 = s_ntt_prime0, p1 = s_ntt_prime1, p2 = s_ntt_prime2;
+        const ntt_dword inv_p0 = ntt_pow(p0, p1 - 2, p1);
+        const ntt_dword inv_p01 = ntt_pow(ntt_dword(p0) * p1 % p2, p2 - 2, p2);
+        const ntt_dword p01 = ntt_dword(p0) * p1;
+        std::vector<ntt_dword> acc(need + 4, 0);
+        for (size_t i = 0; i < need; ++i)
+        {
+            ntt_dword x0 = residues[0][i];
+            ntt_dword x1 = (residues[1][i] + p1 - x0 % p1) % p1 * inv_p0 % p1;
+            ntt_dword t = (x0 + x1 * p0) % p2;
+            ntt_dword x2 = (residues[2][i] + p2 - t) % p2 * inv_p01 % p2;
+            acc[i] += x0;
+            acc[i] += x1 * (p0 & 0xFFFF);
+            acc[i + 1] += x1 * (p0 >> 16);
+            for (int j = 0; j < 4; ++j)
+                acc[i + j] += x2 * ((p01 >> (16 * j)) & 0xFFFF);
+        }
 
-            default:
-                assert(0);
-                break;
-            }
-            break;
+        size_t count = (acc.size() + s_ntt_digits_per_limb - 1) / s_ntt_digits_per_limb;
+        result.backend().resize(static_cast<unsigned>(count),
+                                static_cast<unsigned>(count));
+        limb_type *limbs = result.backend().limbs();
+        std::fill(limbs, limbs + count, limb_type(0));
+        ntt_dword carry = 0;
+        for (size_t i = 0; i < acc.size(); ++i)
+        {
+            carry += acc[i];
+            limbs[i / s_ntt_digits_per_limb] |=
+                limb_type(carry & 0xFFFF) << (16 * (i % s_ntt_digits_per_limb));
+            carry >>= 16;
+        }
+        assert(carry == 0);
+        result.backend().sign(false);
+        result.backend().normalize();
+    }
 
-        case Number::RATIONAL:
-            switch (num.type())
-            {
-            case Number::INTEGER:
-                r = get_r();
-                r += num.to_r();
-                assign(r);
-                break;
+    // unbalanced operands: cut the longer one into pieces as long as the
+    // shorter one
+    static void mul_unbalanced(integer_type& result, const integer_type& a,
+                               const integer_type& b, size_t piece)
+    {
+        integer_type chunk, product;
+        result = 0;
+        for (size_t first = 0; first < limb_count(a); first += piece)
+        {
+            get_limbs(chunk, a, first, piece);
+            mul_magnitude(product, chunk, b, false);
+            product <<= static_cast<unsigned>(first * s_limb_bits);
+            result += product;
+        }
+    }
+
+    static void mul_magnitude(integer_type& result, const integer_type& a,
+                              const integer_type& b, bool square)
+    {
+        const MulThresholds& t = s_mul_thresholds;
+        size_t na = limb_count(a), nb = limb_count(b);
+        size_t n = std::min(na, nb);
+        if (!square && std::max(na, nb) >= 2 * n &&
+            (tier_on(n, t.karatsuba) || tier_on(n, t.toom3) || tier_on(n, t.ntt)))
+        {
+            if (na >= nb)
+                mul_unbalanced(result, a, b, n);
+            else
+                mul_unbalanced(result, b, a, n);
+        }
+        else if (tier_on(n, t.ntt) && ntt_fits(a, b))
+        {
+            mul_ntt(result, a, b, square);
+        }
+        else if (tier_on(n, t.toom3))
+        {
+            mul_toom3(result, a, b, square);
+        }
+        else if (tier_on(n, t.karatsuba))
+        {
+            mul_karatsuba(result, a, b, square);
+        }
+        else
+        {
+            result = a * b;
+            result.backend().sign(false);
+        }
+    }
+
+    void i_mul(integer_type& result, const integer_type& a, const integer_type& b)
+    {
+        const MulThresholds& t = s_mul_thresholds;
+        size_t n = std::min(limb_count(a), limb_count(b));
+        if (!tier_on(n, t.karatsuba) && !tier_on(n, t.toom3) && !tier_on(n, t.ntt))
+        {
+            result = a * b;
+            return;
+        }
+
+        bool negative = (a.sign() < 0) != (b.sign() < 0);
+        integer_type product;
+        mul_magnitude(product, a, b, &a == &b);
+        if (negative)
+            product.backend().sign(true);
+        result.swap(product);
+    }
+
+    void i_sqr(integer_type& result, const integer_type& a)
+    {
+        i_mul(result, a, a);
+    }
+
+    void i_pow(integer_type& result, const integer_type& base, unsigned long e)
+    {
+        integer_type r(1), t;
+        unsigned long bit = 1;
+        while (bit <= e / 2)
+            bit <<= 1;
+        for (; bit != 0 && e != 0; bit >>= 1)
+        {
+            i_sqr(t, r);
+            if (e & bit)
+                i_mul(r, t, base);
+            else
+                r.swap(t);
+        }
+        result.swap(r);
+    }
+} // namespace pmp
+
+/////////////////////////////////////////////////////////////////////////////
+// division engine
+
+namespace pmp
+{
+    static size_t s_div_threshold = 100;
+
+    // extra bits kept when only the leading parts of the operands are divided
+    static const size_t s_div_guard_bits = 64;
+
+    size_t SetDivThreshold(size_t limbs)
+    {
+        size_t old_limbs = s_div_threshold;
+        s_div_threshold = limbs;
+        return old_limbs;
+    }
+
+    size_t bit_length(const integer_type& x)
+    {
+        if (x.is_zero())
+            return 0;
+        size_t n = x.backend().size();
+        b_mp::limb_type top = x.backend().limbs()[n - 1];
+        size_t bits = (n - 1) * s_limb_bits;
+        while (top)
+        {
+            top >>= 1;
+            ++bits;
+        }
+        return bits;
+    }
+
+    // dst limbs [first, ...) = src; dst must be large enough and zeroed
+    static void put_limbs(integer_type& dst, size_t first, const integer_type& src)
+    {
+        if (src.is_zero())
+            return;
+        std::memcpy(dst.backend().limbs() + first, src.backend().limbs(),
+                    limb_count(src) * sizeof(limb_type));
+    }
+
+    // floor(2^(2p) / d) for 2^(p-1) <= d < 2^p
+    static integer_type reciprocal(const integer_type& d, size_t p)
+    {
+        integer_type one(1);
+        one <<= static_cast<unsigned>(2 * p);
+        if (p <= s_div_threshold * s_limb_bits)
+            return one / d;
+
+        // half precision from the leading bits, then one Newton step
+        size_t h = (p + 1) / 2 + 2;
+        integer_type dh = d >> static_cast<unsigned>(p - h);
+        integer_type x = reciprocal(dh, h);
+        x <<= static_cast<unsigned>(p - h);
+
+        integer_type e, t;
+        i_mul(e, d, x);
+        e = one - e;
+        bool negative = e.sign() < 0;
+        if (negative)
+            e = -e;
+        i_mul(t, x, e);
+        t >>= static_cast<unsigned>(2 * p);
+        if (negative)
+            x -= t;
+        else
+            x += t;
+
+        // make it exact
+        i_mul(e, d, x);
+        e = one - e;
+        while (e.sign() < 0)
+        {
+            --x;
+            e += d;
+        }
+        while (e >= d)
+        {
+            ++x;
+            e -= d;
+        }
+        return x;
+    }
+
+    // Barrett step: 0 <= a < b * 2^m, b has m bits, rb = reciprocal(b, m)
+    static void barrett_divmod(integer_type& q, integer_type& r,
+                               const integer_type& a, const integer_type& b,
+                               const integer_type& rb, size_t m)
+    {
+        integer_type t = a >> static_cast<unsigned>(m - 1);
+        i_mul(q, t, rb);
+        q >>= static_cast<unsigned>(m + 1);
+        i_mul(t, q, b);
+        r = a - t;
+        while (r.sign() < 0)
+        {
+            --q;
+            r += b;
+        }
+        while (r >= b)
+        {
+            ++q;
+            r -= b;
+        }
+    }
+
+    // a, b > 0
+    static void divmod_magnitude(integer_type& q, integer_type& r,
+                                 const integer_type& a, const integer_type& b)
+    {
+        size_t n = bit_length(a), m = bit_length(b);
+        if (n < m)
+        {
+            q = 0;
+            r = a;
+            return;
+        }
+
+        size_t k = n - m;
+        if (k + s_div_guard_bits < m)
+        {
+            // short quotient: divide the leading bits, then correct
+            unsigned s = static_cast<unsigned>(m - k - s_div_guard_bits);
+            integer_type a1 = a >> s, b1 = b >> s, t;
+            i_divmod(q, t, a1, b1);
+            i_mul(t, q, b);
+            r = a - t;
+            while (r.sign() < 0)
+            {
+                --q;
+                r += b;
+            }
+            while (r >= b)
+            {
+                ++q;
+                r -= b;
+            }
+            return;
+        }
+
+        integer_type rb = reciprocal(b, m);
+        if (n <= 2 * m)
+        {
+            barrett_divmod(q, r, a, b, rb, m);
+            return;
+        }
+
+        // long quotient: one block of whole limbs at a time from the top
+        assert(m >= s_limb_bits);   // i_divmod keeps one-limb divisors
+        size_t block = m / s_limb_bits;
+        size_t blocks = (limb_count(a) + block - 1) / block;
+        unsigned shift = static_cast<unsigned>(block * s_limb_bits);
+        unsigned size = static_cast<unsigned>(blocks * block);
+        q = 0;
+        q.backend().resize(size, size);
+        std::fill(q.backend().limbs(), q.backend().limbs() + size, limb_type(0));
+
+        integer_type chunk, digit;
+        r = 0;
+        for (size_t j = blocks; j-- > 0; )
+        {
+            get_limbs(chunk, a, j * block, block);
+            r <<= shift;
+            r += chunk;
+            barrett_divmod(digit, chunk, r, b, rb, m);
+            r.swap(chunk);
+            put_limbs(q, j * block, digit);
+        }
+        q.backend().normalize();
+    }
+
+    void i_divmod(integer_type& q, integer_type& r,
+                  const integer_type& a, const integer_type& b)
+    {
+        // The reciprocal costs a few multiplications of the divisor's size,
+        // so a quotient much shorter than the divisor stays with cpp_int.
+        size_t na = limb_count(a), nb = limb_count(b);
+        size_t nq = (na > nb) ? na - nb : 0;
+        size_t t = s_div_threshold;
+        if (t == 0 || b.is_zero() || nb < 2 || 2 * nb < t || nq < t ||
+            (nq < 2 * nb && nq < 4 * t))
+        {
+            if (&q != &a && &q != &b && &r != &a && &r != &b)
+            {
+                // straight into the storage of q and r
+                b_mp::divide_qr(a, b, q, r);
+                return;
+            }
+            integer_type quotient, remainder;
+            b_mp::divide_qr(a, b, quotient, remainder);
+            q.swap(quotient);
+            r.swap(remainder);
+            return;
+        }
+
+        bool q_negative = (a.sign() < 0) != (b.sign() < 0);
+        bool r_negative = a.sign() < 0;
+        integer_type quotient, remainder;
+        divmod_magnitude(quotient, remainder, b_mp::abs(a), b_mp::abs(b));
+        if (q_negative)
+            quotient.backend().sign(true);
+        if (r_negative)
+            remainder.backend().sign(true);
+        q.swap(quotient);
+        r.swap(remainder);
+    }
+
+    // divide and conquer on powers 10^(digits * 2^j)
+    static void i_to_str(std::string& str, const integer_type& i, size_t width,
+                         const std::vector<integer_type>& powers, size_t level,
+                         size_t digits)
+    {
+        if (level == 0)
+        {
+            std::string s = i.str();
+            if (s.size() < width)
+                str.append(width - s.size(), '0');
+            str += s;
+            return;
+        }
+
+        integer_type hi, lo;
+        i_divmod(hi, lo, i, powers[level - 1]);
+        size_t lo_width = digits << (level - 1);
+        if (width == 0 && hi.is_zero())
+        {
+            i_to_str(str, lo, 0, powers, level - 1, digits);
+            return;
+        }
+        i_to_str(str, hi, width ? width - lo_width : 0, powers, level - 1, digits);
+        i_to_str(str, lo, lo_width, powers, level - 1, digits);
+    }
+
+    std::string i_to_str(const integer_type& i)
+    {
+        if (s_div_threshold == 0 || limb_count(i) < 4 * s_div_threshold)
+            return i.str();
+
+        // leaves of about s_div_threshold limbs are left to cpp_int
+        const size_t digits = s_div_threshold * s_limb_bits * 3 / 10;
+        std::vector<integer_type> powers;
+        powers.push_back(b_mp::pow(integer_type(10), static_cast<unsigned>(digits)));
+        for (;;)
+        {
+            integer_type p;
+            i_sqr(p, powers.back());
+            if (p > b_mp::abs(i))
+                break;
+            powers.push_back(p);
+        }
+
+        std::string str;
+        if (i.sign() < 0)
+        {
+            str += '-';
+            i_to_str(str, b_mp::abs(i), 0, powers, powers.size(), digits);
+        }
+        else
+        {
+            i_to_str(str, i, 0, powers, powers.size(), digits);
+        }
+        return str;
+    }
+} // namespace pmp
+
+/////////////////////////////////////////////////////////////////////////////
+// modular arithmetic
+
+namespace pmp
+{
+    typedef b_mp::double_limb_type double_limb_type;
+
+    ModContext::ModContext(const integer_type& modulus) : m_modulus(modulus)
+    {
+        init();
+    }
+
+    ModContext::ModContext(const Number& modulus) : m_modulus(modulus.to_i())
+    {
+        init();
+    }
+
+    void ModContext::init()
+    {
+        if (m_modulus.sign() <= 0)
+            throw std::domain_error("pmp::ModContext: modulus must be positive");
+
+        m_bits = bit_length(m_modulus);
+        m_montgomery = b_mp::bit_test(m_modulus, 0);
+        if (!m_montgomery)
+        {
+            m_mu = reciprocal(m_modulus, m_bits);
+            return;
+        }
+
+        size_t k = limb_count(m_modulus);
+        m_limbs.assign(m_modulus.backend().limbs(), m_modulus.backend().limbs() + k);
+
+        // Newton iteration for 1/m mod 2^limb_bits; m * m == 1 mod 8
+        b_mp::limb_type x = m_limbs[0];
+        for (int i = 0; i < 6; ++i)
+            x *= 2 - m_limbs[0] * x;
+        m_inv = 0 - x;
+
+        integer_type r(1);
+        r <<= static_cast<unsigned>(k * s_limb_bits);
+        to_limbs(m_one, r % m_modulus);
+        i_sqr(r, r);
+        to_limbs(m_r2, r % m_modulus);
+    }
+
+    void ModContext::to_limbs(limbs_type& out, const integer_type& a) const
+    {
+        assert(a.sign() >= 0 && a < m_modulus);
+        out.assign(m_limbs.size(), 0);
+        std::copy(a.backend().limbs(), a.backend().limbs() + limb_count(a), out.begin());
+    }
+
+    void ModContext::from_limbs(integer_type& out, const limbs_type& a) const
+    {
+        out = 0;
+        unsigned k = static_cast<unsigned>(a.size());
+        out.backend().resize(k, k);
+        std::copy(a.begin(), a.end(), out.backend().limbs());
+        out.backend().normalize();
+    }
+
+    // out = a * b / R mod m (CIOS)
+    void ModContext::mont_mul(limbs_type& out, const limbs_type& a,
+                              const limbs_type& b, limbs_type& t) const
+    {
+        const size_t k = m_limbs.size();
+        t.assign(k + 2, 0);
+        for (size_t i = 0; i < k; ++i)
+        {
+            double_limb_type c = 0;
+            for (size_t j = 0; j < k; ++j)
+            {
+                c += double_limb_type(a[j]) * b[i] + t[j];
+                t[j] = static_cast<b_mp::limb_type>(c);
+                c >>= s_limb_bits;
+            }
+            c += t[k];
+            t[k] = static_cast<b_mp::limb_type>(c);
+            t[k + 1] = static_cast<b_mp::limb_type>(c >> s_limb_bits);
+
+            b_mp::limb_type u = t[0] * m_inv;
+            c = double_limb_type(u) * m_limbs[0] + t[0];
+            c >>= s_limb_bits;
+            for (size_t j = 1; j < k; ++j)
+            {
+                c += double_limb_type(u) * m_limbs[j] + t[j];
+                t[j - 1] = static_cast<b_mp::limb_type>(c);
+                c >>= s_limb_bits;
+            }
+            c += t[k];
+            t[k - 1] = static_cast<b_mp::limb_type>(c);
+            t[k] = t[k + 1] + static_cast<b_mp::limb_type>(c >> s_limb_bits);
+        }
+
+        // t < 2m; subtract m once if needed
+        bool subtract = (t[k] != 0);
+        if (!subtract)
+        {
+            subtract = true;
+            for (size_t j = k; j-- > 0; )
+            {
+                if (t[j] != m_limbs[j])
+                {
+                    subtract = (t[j] > m_limbs[j]);
+                    break;
+                }
+            }
+        }
+        out.resize(k);
+        if (subtract)
+        {
+            b_mp::limb_type borrow = 0;
+            for (size_t j = 0; j < k; ++j)
+            {
+                b_mp::limb_type x = t[j], y = m_limbs[j];
+                b_mp::limb_type d = x - y - borrow;
+                borrow = (x < y || (x == y && borrow)) ? 1 : 0;
+                out[j] = d;
+            }
+        }
+        else
+        {
+            std::copy(t.begin(), t.begin() + k, out.begin());
+        }
+    }
+
+    integer_type ModContext::barrett(const integer_type& a) const
+    {
+        assert(a.sign() >= 0);
+        if (a < m_modulus)
+            return a;
+        integer_type q, r;
+        barrett_divmod(q, r, a, m_modulus, m_mu, m_bits);
+        return r;
+    }
+
+    integer_type ModContext::reduce(const integer_type& a) const
+    {
+        if (a.sign() >= 0 && a < m_modulus)
+            return a;
+        integer_type q, r;
+        i_divmod(q, r, a, m_modulus);
+        if (r.sign() < 0)
+            r += m_modulus;
+        return r;
+    }
+
+    integer_type ModContext::mulmod(const integer_type& a, const integer_type& b) const
+    {
+        if (!m_montgomery)
+            return barrett(i_mul(reduce(a), reduce(b)));
+
+        // a * b / R * R^2 / R
+        limbs_type x, y, t;
+        to_limbs(x, reduce(a));
+        to_limbs(y, reduce(b));
+        mont_mul(x, x, y, t);
+        mont_mul(x, x, m_r2, t);
+        integer_type result;
+        from_limbs(result, x);
+        return result;
+    }
+
+    integer_type ModContext::powmod(const integer_type& base, const integer_type& e) const
+    {
+        if (e.sign() < 0)
+        {
+            integer_type inv;
+            if (!invmod(inv, base))
+                throw std::domain_error("pmp::ModContext: not invertible");
+            return powmod(inv, -e);
+        }
+        if (m_modulus == 1)
+            return 0;
+
+        // fixed 4-bit window
+        const unsigned window = 4;
+        size_t bits = e.is_zero() ? 0 : bit_length(e);
+        if (!m_montgomery)
+        {
+            integer_type table[1 << window];
+            table[0] = 1;
+            table[1] = reduce(base);
+            for (unsigned i = 2; i < (1u << window); ++i)
+                table[i] = barrett(i_mul(table[i - 1], table[1]));
+
+            integer_type result(1);
+            for (size_t pos = (bits + window - 1) / window * window; pos > 0; )
+            {
+                pos -= window;
+                for (unsigned i = 0; i < window; ++i)
+                    result = barrett(i_mul(result, result));
+                unsigned digit = static_cast<unsigned>(
+                    integer_type(e >> static_cast<unsigned>(pos)).convert_to<unsigned long>()
+                    & ((1u << window) - 1));
+                if (digit)
+                    result = barrett(i_mul(result, table[digit]));
+            }
+            return result;
+        }
+
+        limbs_type table[1 << window], result, t;
+        table[0] = m_one;
+        to_limbs(table[1], reduce(base));
+        mont_mul(table[1], table[1], m_r2, t);
+        for (unsigned i = 2; i < (1u << window); ++i)
+            mont_mul(table[i], table[i - 1], table[1], t);
+
+        result = m_one;
+        for (size_t pos = (bits + window - 1) / window * window; pos > 0; )
+        {
+            pos -= window;
+            for (unsigned i = 0; i < window; ++i)
+                mont_mul(result, result, result, t);
+            unsigned digit = 0;
+            for (unsigned i = window; i-- > 0; )
+                digit = (digit << 1) | (b_mp::bit_test(e, static_cast<unsigned>(pos + i)) ? 1 : 0);
+            if (digit)
+                mont_mul(result, result, table[digit], t);
+        }
+
+        limbs_type one(m_limbs.size(), 0);
+        one[0] = 1;
+        mont_mul(result, result, one, t);
+        integer_type value;
+        from_limbs(value, result);
+        return value;
+    }
+
+    bool ModContext::invmod(integer_type& result, const integer_type& a) const
+    {
+        // extended Euclid on (a, m)
+        integer_type r0 = m_modulus, r1 = reduce(a), s0 = 0, s1 = 1, q, r2;
+        while (!r1.is_zero())
+        {
+            i_divmod(q, r2, r0, r1);
+            r0.swap(r1);
+            r1.swap(r2);
+            s0 -= i_mul(q, s1);
+            s0.swap(s1);
+        }
+        if (r0 != 1)
+            return false;
+        result = reduce(s0);
+        return true;
+    }
+
+    Number ModContext::mulmod(const Number& a, const Number& b) const
+    {
+#ifndef PMP_DISABLE_VECTOR
+        if (a.is_v() || b.is_v())
+        {
+            vector_type vec;
+            for (size_t i = 0; i < a.size(); ++i)
+            {
+                for (size_t j = 0; j < b.size(); ++j)
+                    vec.push_back(mulmod(a[i], b[j]));
+            }
+            return Number(vec);
+        }
+#endif
+        return Number(mulmod(a.to_i(), b.to_i()));
+    }
+
+    Number ModContext::powmod(const Number& base, const Number& e) const
+    {
+#ifndef PMP_DISABLE_VECTOR
+        assert(!e.is_v());
+        if (base.is_v())
+        {
+            vector_type vec;
+            for (size_t i = 0; i < base.size(); ++i)
+                vec.push_back(powmod(base[i], e));
+            return Number(vec);
+        }
+#endif
+        return Number(powmod(base.to_i(), e.to_i()));
+    }
+
+    Number ModContext::invmod(const Number& a) const
+    {
+#ifndef PMP_DISABLE_VECTOR
+        if (a.is_v())
+            return Number(invmod(a.get_v()));
+#endif
+        integer_type result;
+        if (!invmod(result, a.to_i()))
+            throw std::domain_error("pmp::ModContext: not invertible");
+        return Number(result);
+    }
+
+    vector_type ModContext::invmod(const vector_type& values) const
+    {
+        // prefix products, one inversion, then walk back
+        size_t n = values.size();
+        std::vector<integer_type> prefix(n);
+        integer_type acc(1);
+        for (size_t i = 0; i < n; ++i)
+        {
+            acc = mulmod(acc, values[i].to_i());
+            prefix[i] = acc;
+        }
+
+        integer_type inv;
+        if (n == 0)
+            return vector_type();
+        if (!invmod(inv, acc))
+            throw std::domain_error("pmp::ModContext: not invertible");
+
+        vector_type result(n);
+        for (size_t i = n; i-- > 0; )
+        {
+            if (i == 0)
+            {
+                result[0] = Number(inv);
+                break;
+            }
+            result[i] = Number(mulmod(inv, prefix[i - 1]));
+            inv = mulmod(inv, values[i].to_i());
+        }
+        return result;
+    }
+
+    Number powmod(const Number& base, const Number& e, const Number& m)
+    {
+        return ModContext(m).powmod(base, e);
+    }
+
+    Number invmod(const Number& a, const Number& m)
+    {
+        return ModContext(m).invmod(a);
+    }
+} // namespace pmp
+
+/////////////////////////////////////////////////////////////////////////////
+// number theory
+
+namespace pmp
+{
+    integer_type i_gcd(const integer_type& a, const integer_type& b)
+    {
+        // Boost's cpp_int gcd (Lehmer steps on newer versions)
+        return b_mp::gcd(a, b);
+    }
+
+    integer_type i_lcm(const integer_type& a, const integer_type& b)
+    {
+        if (a.is_zero() || b.is_zero())
+            return 0;
+        integer_type q, r;
+        i_divmod(q, r, integer_type(b_mp::abs(a)), i_gcd(a, b));
+        return i_mul(q, integer_type(b_mp::abs(b)));
+    }
+
+    integer_type i_isqrt(const integer_type& x)
+    {
+        if (x.sign() < 0)
+            throw std::domain_error("pmp::isqrt: negative argument");
+        if (x < 2)
+            return x;
+
+        // Newton from above: 2^ceil(bits/2) >= sqrt(x)
+        integer_type y(1), z, q, r;
+        y <<= static_cast<unsigned>((bit_length(x) + 1) / 2);
+        for (;;)
+        {
+            i_divmod(q, r, x, y);
+            z = (y + q) >> 1;
+            if (z >= y)
+                return y;
+            y.swap(z);
+        }
+    }
+
+    bool i_iroot(integer_type& root, const integer_type& x, unsigned long n)
+    {
+        if (n == 0)
+            throw std::domain_error("pmp::iroot: zeroth root");
+        if (x.sign() < 0)
+        {
+            if (n % 2 == 0)
+                throw std::domain_error("pmp::iroot: even root of negative");
+            bool exact = i_iroot(root, -x, n);
+            root = -root;
+            return exact;
+        }
+        if (n == 1 || x < 2)
+        {
+            root = x;
+            return true;
+        }
+
+        size_t bits = bit_length(x);
+        if (n >= bits)
+        {
+            root = 1;
+            return x == 1;
+        }
+        if (n == 2)
+        {
+            root = i_isqrt(x);
+            return i_mul(root, root) == x;
+        }
+
+        // Newton from above: y' = ((n - 1) y + x / y^(n-1)) / n
+        integer_type y(1), z, p, q, r;
+        y <<= static_cast<unsigned>((bits + n - 1) / n);
+        for (;;)
+        {
+            i_pow(p, y, n - 1);
+            i_divmod(q, r, x, p);
+            z = (y * (n - 1) + q) / n;
+            if (z >= y)
+                break;
+            y.swap(z);
+        }
+        i_pow(p, y, n);
+        root = y;
+        return p == x;
+    }
+
+    static const unsigned s_small_primes[] =
+    {
+        2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61,
+        67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131, 137,
+        139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199
+    };
+    static const size_t s_num_small_primes =
+        sizeof(s_small_primes) / sizeof(s_small_primes[0]);
+
+    bool i_is_prime(const integer_type& n, unsigned rounds/* = 25*/)
+    {
+        if (n < 2)
+            return false;
+        if (n <= s_small_primes[s_num_small_primes - 1])
+        {
+            unsigned u = n.convert_to<unsigned>();
+            for (size_t i = 0; i < s_num_small_primes; ++i)
+            {
+                if (s_small_primes[i] == u)
+                    return true;
+            }
+            return false;
+        }
+        for (size_t i = 0; i < s_num_small_primes; ++i)
+        {
+            if (b_mp::integer_modulus(n, s_small_primes[i]) == 0)
+                return false;
+        }
+
+        // Miller-Rabin with the first primes as bases; the first 13 bases
+        // make it deterministic below 3.3e24
+        integer_type d = n - 1;
+        unsigned s = 0;
+        while (!b_mp::bit_test(d, s))
+            ++s;
+        d >>= s;
+
+        ModContext ctx(n);
+        const integer_type n1 = n - 1;
+        if (rounds > s_num_small_primes)
+            rounds = static_cast<unsigned>(s_num_small_primes);
+        for (unsigned i = 0; i < rounds; ++i)
+        {
+            integer_type x = ctx.powmod(s_small_primes[i], d);
+            if (x == 1 || x == n1)
+                continue;
+            unsigned j;
+            for (j = 1; j < s; ++j)
+            {
+                x = ctx.mulmod(x, x);
+                if (x == n1)
+                    break;
+            }
+            if (j == s)
+                return false;
+        }
+        return true;
+    }
+
+    Number gcd(const Number& num1, const Number& num2)
+    {
+#ifndef PMP_DISABLE_VECTOR
+        if (num1.is_v() || num2.is_v())
+        {
+            vector_type vec;
+            for (size_t i = 0; i < num1.size(); ++i)
+            {
+                for (size_t j = 0; j < num2.size(); ++j)
+                    vec.push_back(pmp::gcd(num1[i], num2[j]));
+            }
+            return Number(vec);
+        }
+#endif
+        return Number(i_gcd(num1.to_i(), num2.to_i()));
+    }
+
+    Number lcm(const Number& num1, const Number& num2)
+    {
+#ifndef PMP_DISABLE_VECTOR
+        if (num1.is_v() || num2.is_v())
+        {
+            vector_type vec;
+            for (size_t i = 0; i < num1.size(); ++i)
+            {
+                for (size_t j = 0; j < num2.size(); ++j)
+                    vec.push_back(pmp::lcm(num1[i], num2[j]));
+            }
+            return Number(vec);
+        }
+#endif
+        return Number(i_lcm(num1.to_i(), num2.to_i()));
+    }
+
+    Number isqrt(const Number& num1)
+    {
+#ifndef PMP_DISABLE_VECTOR
+        if (num1.is_v())
+        {
+            vector_type vec;
+            for (size_t i = 0; i < num1.size(); ++i)
+                vec.push_back(pmp::isqrt(num1[i]));
+            return Number(vec);
+        }
+#endif
+        return Number(i_isqrt(num1.to_i()));
+    }
+
+    Number iroot(const Number& num1, unsigned long n)
+    {
+#ifndef PMP_DISABLE_VECTOR
+        if (num1.is_v())
+        {
+            vector_type vec;
+            for (size_t i = 0; i < num1.size(); ++i)
+                vec.push_back(pmp::iroot(num1[i], n));
+            return Number(vec);
+        }
+#endif
+        integer_type root;
+        i_iroot(root, num1.to_i(), n);
+        return Number(root);
+    }
+
+    Number bit_length(const Number& num1)
+    {
+#ifndef PMP_DISABLE_VECTOR
+        if (num1.is_v())
+        {
+            vector_type vec;
+            for (size_t i = 0; i < num1.size(); ++i)
+                vec.push_back(pmp::bit_length(num1[i]));
+            return Number(vec);
+        }
+#endif
+        return Number(integer_type(bit_length(num1.to_i())));
+    }
+
+    Number ilog2(const Number& num1)
+    {
+#ifndef PMP_DISABLE_VECTOR
+        if (num1.is_v())
+        {
+            vector_type vec;
+            for (size_t i = 0; i < num1.size(); ++i)
+                vec.push_back(pmp::ilog2(num1[i]));
+            return Number(vec);
+        }
+#endif
+        size_t bits = bit_length(num1.to_i());
+        if (bits == 0)
+            throw std::domain_error("pmp::ilog2: zero argument");
+        return Number(integer_type(bits - 1));
+    }
+
+    bool is_prime(const Number& num1, unsigned rounds/* = 25*/)
+    {
+#ifndef PMP_DISABLE_VECTOR
+        assert(!num1.is_v());
+#endif
+        return num1.is_i() && i_is_prime(num1.get_i(), rounds);
+    }
+
+    static std::vector<char>
+    is_prime_range(const std::vector<integer_type>& values,
+                   size_t first, size_t last, unsigned rounds)
+    {
+        std::vector<char> flags(last - first);
+        for (size_t i = first; i < last; ++i)
+            flags[i - first] = i_is_prime(values[i], rounds);
+        return flags;
+    }
+
+    std::vector<bool> is_prime(const vector_type& values, unsigned rounds/* = 25*/,
+                               unsigned num_threads/* = 1*/)
+    {
+        // non-integers are never prime; skip them before the heavy work
+        std::vector<integer_type> ints(values.size());
+        for (size_t i = 0; i < values.size(); ++i)
+        {
+            if (values[i].is_i())
+                ints[i] = values[i].get_i();
+        }
+
+        // split into one chunk per thread; the first runs on this thread
+        size_t n = values.size();
+#ifdef PMP_SINGLE_THREADED
+        num_threads = 1;    // the reference counts are not atomic
+#endif
+        if (num_threads < 1)
+            num_threads = 1;
+        if (num_threads > n)
+            num_threads = static_cast<unsigned>(n ? n : 1);
+        size_t chunk = (n + num_threads - 1) / num_threads;
+        std::vector<std::future<std::vector<char> > > tasks;
+        for (size_t first = chunk; first < n; first += chunk)
+        {
+            tasks.push_back(std::async(std::launch::async, is_prime_range,
+                                       std::cref(ints), first,
+                                       std::min(first + chunk, n), rounds));
+        }
+
+        std::vector<bool> result;
+        result.reserve(n);
+        std::vector<char> flags = is_prime_range(ints, 0, std::min(chunk, n), rounds);
+        result.insert(result.end(), flags.begin(), flags.end());
+        for (size_t i = 0; i < tasks.size(); ++i)
+        {
+            flags = tasks[i].get();
+            result.insert(result.end(), flags.begin(), flags.end());
+        }
+        return result;
+    }
+
+    // primes <= n by the sieve of Eratosthenes
+    static void sieve_primes(std::vector<unsigned long>& primes, unsigned long n)
+    {
+        primes.clear();
+        if (n < 2)
+            return;
+        std::vector<char> composite(n + 1);
+        for (unsigned long i = 2; i <= n; ++i)
+        {
+            if (composite[i])
+                continue;
+            primes.push_back(i);
+            if (i > n / i)
+                continue;
+            for (unsigned long j = i * i; j <= n; j += i)
+                composite[j] = 1;
+        }
+    }
+
+    // product of factors[first, last); leaves pack several factors per limb
+    static integer_type
+    small_product(const std::vector<unsigned long>& factors, size_t first, size_t last)
+    {
+        if (last - first > 16)
+        {
+            size_t mid = first + (last - first) / 2;
+            return i_mul(small_product(factors, first, mid),
+                         small_product(factors, mid, last));
+        }
+
+        integer_type result(1);
+        b_mp::limb_type acc = 1;
+        for (size_t i = first; i < last; ++i)
+        {
+            b_mp::limb_type f = factors[i];
+            if (f > ~b_mp::limb_type(0) / acc)
+            {
+                result *= acc;
+                acc = 1;
+            }
+            acc *= f;
+        }
+        result *= acc;
+        return result;
+    }
+
+    static integer_type small_product(const std::vector<unsigned long>& factors)
+    {
+        return factors.empty() ? integer_type(1)
+                               : small_product(factors, 0, factors.size());
+    }
+
+    integer_type i_factorial(unsigned long n)
+    {
+        // odd parts only; the powers of two become one shift
+        std::vector<unsigned long> factors;
+        unsigned long shift = 0;
+        for (unsigned long i = 3; i <= n; ++i)
+        {
+            unsigned long f = i;
+            while (!(f & 1))
+            {
+                f >>= 1;
+                ++shift;
+            }
+            if (f > 1)
+                factors.push_back(f);
+        }
+        if (n >= 2)
+            ++shift;
+
+        integer_type result = small_product(factors);
+        result <<= shift;
+        return result;
+    }
+
+    integer_type i_binomial(unsigned long n, unsigned long k)
+    {
+        if (k > n)
+            return 0;
+        if (k > n - k)
+            k = n - k;
+        if (k == 0)
+            return 1;
+
+        std::vector<unsigned long> factors;
+        if (k < 32 || n / 64 > k)
+        {
+            // few factors: n (n-1) ... (n-k+1) / k!
+            for (unsigned long i = 0; i < k; ++i)
+                factors.push_back(n - i);
+            integer_type q, r;
+            i_divmod(q, r, small_product(factors), i_factorial(k));
+            assert(r.is_zero());
+            return q;
+        }
+
+        // the exponent of p in C(n, k) by Legendre's formula
+        std::vector<unsigned long> primes;
+        sieve_primes(primes, n);
+        for (size_t i = 0; i < primes.size(); ++i)
+        {
+            unsigned long p = primes[i];
+            unsigned long e = 0;
+            for (unsigned long pk = p; ; pk *= p)
+            {
+                e += n / pk - k / pk - (n - k) / pk;
+                if (pk > n / p)
+                    break;
+            }
+            for (; e > 0; --e)
+                factors.push_back(p);
+        }
+        return small_product(factors);
+    }
+
+    integer_type i_primorial(unsigned long n)
+    {
+        std::vector<unsigned long> primes;
+        sieve_primes(primes, n);
+        return small_product(primes);
+    }
+
+    static unsigned long to_ulong(const Number& num, const char *what)
+    {
+        integer_type i = num.to_i();
+        if (i.sign() < 0 || i > std::numeric_limits<unsigned long>::max())
+            throw std::domain_error(what);
+        return i.convert_to<unsigned long>();
+    }
+
+    Number factorial(const Number& n)
+    {
+#ifndef PMP_DISABLE_VECTOR
+        if (n.is_v())
+        {
+            vector_type vec;
+            for (size_t i = 0; i < n.size(); ++i)
+                vec.push_back(pmp::factorial(n[i]));
+            return Number(vec);
+        }
+#endif
+        return Number(i_factorial(to_ulong(n, "pmp::factorial: bad argument")));
+    }
+
+    Number binomial(const Number& n, const Number& k)
+    {
+#ifndef PMP_DISABLE_VECTOR
+        if (n.is_v() || k.is_v())
+        {
+            vector_type vec;
+            for (size_t i = 0; i < n.size(); ++i)
+            {
+                for (size_t j = 0; j < k.size(); ++j)
+                    vec.push_back(pmp::binomial(n[i], k[j]));
+            }
+            return Number(vec);
+        }
+#endif
+        if (k.to_i().sign() < 0 || k.to_i() > n.to_i())
+            return Number(0);
+        return Number(i_binomial(to_ulong(n, "pmp::binomial: bad argument"),
+                                 to_ulong(k, "pmp::binomial: bad argument")));
+    }
+
+    Number primorial(const Number& n)
+    {
+#ifndef PMP_DISABLE_VECTOR
+        if (n.is_v())
+        {
+            vector_type vec;
+            for (size_t i = 0; i < n.size(); ++i)
+                vec.push_back(pmp::primorial(n[i]));
+            return Number(vec);
+        }
+#endif
+        return Number(i_primorial(to_ulong(n, "pmp::primorial: bad argument")));
+    }
+} // namespace pmp
+
+/////////////////////////////////////////////////////////////////////////////
+// constants
+
+namespace pmp
+{
+    namespace
+    {
+        // pi = 426880 sqrt(10005) / sum; terms alternate in sign
+        struct ChudnovskySeries
+        {
+            integer_type p(unsigned long k) const
+            {
+                if (k == 0)
+                    return 1;
+                integer_type x(6 * k - 5);
+                x *= 2 * k - 1;
+                x *= 6 * k - 1;
+                return -x;
+            }
+            integer_type q(unsigned long k) const
+            {
+                if (k == 0)
+                    return 1;
+                integer_type x(k);
+                x *= k;
+                x *= k;
+                x *= 10939058860032000ULL;  // 640320^3 / 24
+                return x;
+            }
+            integer_type a(unsigned long k) const
+            {
+                integer_type x(545140134);
+                x *= k;
+                x += 13591409;
+                return x;
+            }
+        };
+
+        // e = sum 1 / k!
+        struct ExpSeries
+        {
+            integer_type p(unsigned long) const { return 1; }
+            integer_type q(unsigned long k) const { return k ? k : 1; }
+            integer_type a(unsigned long) const { return 1; }
+        };
+
+        // atanh(1/m) = sum 1 / ((2k + 1) m^(2k+1))
+        struct AtanhSeries
+        {
+            unsigned long m;
+            explicit AtanhSeries(unsigned long m_) : m(m_) { }
+
+            integer_type p(unsigned long k) const
+            {
+                return k ? integer_type(2 * k - 1) : integer_type(1);
+            }
+            integer_type q(unsigned long k) const
+            {
+                if (k == 0)
+                    return m;
+                integer_type x(2 * k + 1);
+                x *= m;
+                x *= m;
+                return x;
+            }
+            integer_type a(unsigned long) const { return 1; }
+        };
+    } // namespace
+
+    static const size_t s_constant_guard = 10;
+
+    // all the digits floating_type carries, guard digits included
+    static const size_t s_floating_digits =
+        std::numeric_limits<floating_type>::max_digits10;
+
+    static integer_type pow10(size_t n)
+    {
+        integer_type result;
+        i_pow(result, 10, static_cast<unsigned long>(n));
+        return result;
+    }
+
+    // floor(T / Q * 10^digits)
+    template <typename Series>
+    static integer_type series_fixed(const Series& series, unsigned long terms,
+                                     size_t digits)
+    {
+        integer_type P, Q, T, q, r;
+        binary_split(P, Q, T, series, 0, terms);
+        i_divmod(q, r, i_mul(T, pow10(digits)), Q);
+        return q;
+    }
+
+    static integer_type atanh_fixed(unsigned long m, size_t digits)
+    {
+        unsigned long terms = static_cast<unsigned long>(
+            digits * 2.302585093 / (2 * std::log(double(m)))) + 2;
+        return series_fixed(AtanhSeries(m), terms, digits);
+    }
+
+    static integer_type compute_constant(ConstantType c, size_t digits)
+    {
+        const size_t d = digits + s_constant_guard;
+        integer_type x, q, r;
+        switch (c)
+        {
+        case CONSTANT_PI:
+            {
+                // about 14.18 digits per term
+                unsigned long terms = static_cast<unsigned long>(d / 14.18) + 2;
+                integer_type P, Q, T;
+                binary_split(P, Q, T, ChudnovskySeries(), 0, terms);
+                x = i_isqrt(i_mul(integer_type(10005), pow10(2 * d)));
+                x = i_mul(x, Q) * 426880;
+                i_divmod(q, r, x, T);
+                x.swap(q);
+            }
+            break;
+
+        case CONSTANT_E:
+            {
+                unsigned long terms = 2;
+                for (double log10_fact = 0; log10_fact < d + 1; ++terms)
+                    log10_fact += std::log10(double(terms));
+                x = series_fixed(ExpSeries(), terms, d);
+            }
+            break;
+
+        case CONSTANT_LN2:
+            // 18 atanh(1/26) - 2 atanh(1/4801) + 8 atanh(1/8749)
+            x = atanh_fixed(26, d) * 18;
+            x -= atanh_fixed(4801, d) * 2;
+            x += atanh_fixed(8749, d) * 8;
+            break;
+
+        case CONSTANT_LN10:
+            // 3 ln 2 + ln(5/4), ln(5/4) = 2 atanh(1/9)
+            x = i_constant(CONSTANT_LN2, d) * 3;
+            x += atanh_fixed(9, d) * 2;
+            break;
+
+        case CONSTANT_SQRT2:
+            x = i_isqrt(pow10(2 * d) * 2);
+            break;
+
+        default:
+            throw std::domain_error("pmp::i_constant: unknown constant");
+        }
+
+        i_divmod(q, r, x, pow10(s_constant_guard));
+        return q;
+    }
+
+    // Entries are immutable and never freed, so a reader may keep using an
+    // entry that has just been replaced.  Replaced entries stay reachable
+    // through m_older.
+    struct ConstantEntry
+    {
+        size_t                  m_digits;
+        integer_type            m_value;
+        const ConstantEntry *   m_older;
+    };
+
+    static std::atomic<const ConstantEntry *> s_constants[CONSTANT_COUNT];
+    static std::atomic<const floating_type *> s_f_constants[CONSTANT_COUNT];
+
+    integer_type i_constant(ConstantType c, size_t digits)
+    {
+        if (static_cast<unsigned>(c) >= CONSTANT_COUNT)
+            throw std::domain_error("pmp::i_constant: unknown constant");
+
+        const ConstantEntry *entry = s_constants[c].load(std::memory_order_acquire);
+        if (entry == NULL || entry->m_digits < digits)
+        {
+            // grow geometrically so that creeping precision stays cheap
+            size_t want = digits;
+            if (entry && want < entry->m_digits + entry->m_digits / 2)
+                want = entry->m_digits + entry->m_digits / 2;
+            want = (want + 63) / 64 * 64;
+
+            // entries outlive any arena
+            Arena::Suspend suspend;
+            ConstantEntry *mine = new ConstantEntry;
+            mine->m_digits = want;
+            mine->m_value = compute_constant(c, want);
+            mine->m_older = entry;
+            while (!s_constants[c].compare_exchange_weak(
+                       entry, mine, std::memory_order_acq_rel))
+            {
+                if (entry && entry->m_digits >= want)
+                {
+                    // another thread got there first with enough digits
+                    delete mine;
+                    mine = NULL;
+                    break;
+                }
+                mine->m_older = entry;
+            }
+            if (mine)
+                entry = mine;
+        }
+
+        if (entry->m_digits == digits)
+            return entry->m_value;
+        integer_type q, r;
+        i_divmod(q, r, entry->m_value, pow10(entry->m_digits - digits));
+        return q;
+    }
+
+    const floating_type& f_constant(ConstantType c)
+    {
+        if (static_cast<unsigned>(c) >= CONSTANT_COUNT)
+            throw std::domain_error("pmp::f_constant: unknown constant");
+
+        const floating_type *f = s_f_constants[c].load(std::memory_order_acquire);
+        if (f)
+            return *f;
+
+        const size_t digits = s_floating_digits + s_constant_guard;
+        floating_type *mine = new floating_type(i_constant(c, digits));
+        *mine /= floating_type(pow10(digits));
+        if (s_f_constants[c].compare_exchange_strong(f, mine,
+                                                     std::memory_order_acq_rel))
+        {
+            return *mine;
+        }
+        delete mine;
+        return *f;
+    }
+
+    // floor(|f| * 10^digits) from the exact decimal digits of f
+    static integer_type f_to_fixed(const floating_type& f, size_t digits)
+    {
+        std::string str = f.str(0, std::ios_base::scientific);
+        size_t e = str.find('e');
+        long exp10 = std::atol(str.c_str() + e + 1);
+        std::string mantissa;
+        for (size_t i = 0; i < e; ++i)
+        {
+            if (std::isdigit(static_cast<unsigned char>(str[i])))
+                mantissa += str[i];
+        }
+
+        // value = mantissa * 10^(exp10 - (size - 1))
+        integer_type x(mantissa);
+        long shift = exp10 - long(mantissa.size() - 1) + long(digits);
+        if (shift >= 0)
+            return i_mul(x, pow10(shift));
+        integer_type q, r;
+        i_divmod(q, r, x, pow10(-shift));
+        return q;
+    }
+
+    // below this order Boost's own reduction keeps full precision
+    static const long s_reduce_min_order = 8;
+    // above this order the reduction would need more digits of pi than
+    // are worth computing and caching; the result is NaN
+    static const long s_reduce_max_order = 4 * static_cast<long>(s_floating_digits);
+
+    // f = k (pi / 2) + r with |r| <= pi / 4; returns k mod 4
+    static unsigned reduce_half_pi(floating_type& r, const floating_type& f)
+    {
+        floating_type a = b_mp::abs(f);
+        const floating_type& pi = f_constant(CONSTANT_PI);
+        if (a.backend().order() < s_reduce_min_order)
+        {
+            if (a <= pi / 4)
+            {
+                r = f;
+                return 0;
+            }
+            floating_type half_pi = pi / 2;
+            long k = b_mp::lround(f / half_pi);
+            r = f - half_pi * k;
+            return static_cast<unsigned>(k & 3);
+        }
+
+        if (a.backend().order() > s_reduce_max_order)
+        {
+            r = std::numeric_limits<floating_type>::quiet_NaN();
+            return 0;
+        }
+
+        // enough digits of pi that the product k * pi/2 stays exact to
+        // the working precision
+        size_t digits = s_floating_digits + s_constant_guard;
+        if (a.backend().order() > 0)
+            digits += static_cast<size_t>(a.backend().order());
+
+        integer_type x = f_to_fixed(a, digits);
+        integer_type half_pi = i_constant(CONSTANT_PI, digits + 1) / 20;
+        integer_type k, rem;
+        i_divmod(k, rem, x + (half_pi >> 1), half_pi);
+        rem = x - i_mul(k, half_pi);
+
+        r = floating_type(rem) / floating_type(pow10(digits));
+        unsigned quadrant = static_cast<unsigned>(b_mp::integer_modulus(k, 4));
+        if (f.sign() < 0)
+        {
+            r = -r;
+            quadrant = (4 - quadrant) % 4;
+        }
+        return quadrant;
+    }
+
+    //
+    // series kernels
+    //
+    // Coefficient tables are built once and shared.  The kernels expect
+    // reduced arguments and carry s_series_digits digits.
+    //
+    static const int s_series_digits = static_cast<int>(s_floating_digits);
+    static const unsigned s_series_terms = 100;
+
+    // exp(j / s_exp_steps) is tabulated for |j / s_exp_steps| <= ln2 / 2
+    static const int s_exp_steps = 256;
+    static const int s_exp_table = 90;
+    static const int s_exp_halvings = 6;
+
+    struct SeriesTables
+    {
+        floating_type m_inv_fact[s_series_terms];   // 1 / k!
+        floating_type m_inv_odd[s_series_terms];    // 1 / (2k + 1)
+        floating_type m_ln2;
+        floating_type m_inv_ln2;
+        floating_type m_exp[2 * s_exp_table + 1];   // exp((j - s_exp_table) / s_exp_steps)
+    };
+
+    static floating_type kernel_expm1(const SeriesTables& tables, const floating_type& r);
+
+    static std::atomic<const SeriesTables *> s_series_tables;
+
+    static const SeriesTables& series_tables()
+    {
+        const SeriesTables *tables = s_series_tables.load(std::memory_order_acquire);
+        if (tables)
+            return *tables;
+
+        SeriesTables *mine = new SeriesTables;
+        mine->m_inv_fact[0] = 1;
+        for (unsigned k = 1; k < s_series_terms; ++k)
+            mine->m_inv_fact[k] = mine->m_inv_fact[k - 1] / k;
+        for (unsigned k = 0; k < s_series_terms; ++k)
+            mine->m_inv_odd[k] = floating_type(1) / (2 * k + 1);
+        mine->m_ln2 = f_constant(CONSTANT_LN2);
+        mine->m_inv_ln2 = 1 / mine->m_ln2;
+        for (int j = -s_exp_table; j <= s_exp_table; ++j)
+        {
+            floating_type r = floating_type(j) / s_exp_steps;
+            floating_type e = kernel_expm1(*mine, b_mp::ldexp(r, -s_exp_halvings));
+            for (int i = 0; i < s_exp_halvings; ++i)
+                e *= e + 2;
+            mine->m_exp[j + s_exp_table] = e + 1;
+        }
+
+        if (s_series_tables.compare_exchange_strong(tables, mine,
+                                                    std::memory_order_acq_rel))
+        {
+            return *mine;
+        }
+        delete mine;
+        return *tables;
+    }
+
+    // smallest n with |x|^n / n! below the working precision
+    static unsigned series_terms(const floating_type& x, unsigned step)
+    {
+        if (x.is_zero())
+            return 1;
+        double lx = std::log10(b_mp::abs(x).convert_to<double>());
+        double term = 0;
+        unsigned n = 1;
+        for (; n < s_series_terms - step; ++n)
+        {
+            term += lx - std::log10(double(n));
+            if (term < -s_series_digits && n % step == 0)
+                break;
+        }
+        return n;
+    }
+
+    // exp(r) - 1 for small r
+    static floating_type kernel_expm1(const SeriesTables& tables, const floating_type& r)
+    {
+        unsigned n = series_terms(r, 1);
+        floating_type sum = tables.m_inv_fact[n];
+        for (unsigned k = n; k-- > 1; )
+        {
+            sum *= r;
+            sum += tables.m_inv_fact[k];
+        }
+        return sum * r;
+    }
+
+    // sin(r) or cos(r) for |r| <= pi/4, or NaN
+    static floating_type kernel_sincos(const SeriesTables& tables,
+                                       const floating_type& r, bool cosine)
+    {
+        if (b_mp::isnan(r))
+            return r;   // reduce_half_pi gave up
+        unsigned n = series_terms(r, 2) / 2 + 1;
+        unsigned first = cosine ? 0 : 1;
+        floating_type r2 = r * r, sum = 0;
+        for (unsigned k = n + 1; k-- > 0; )
+        {
+            sum *= r2;
+            if (k % 2)
+                sum -= tables.m_inv_fact[2 * k + first];
+            else
+                sum += tables.m_inv_fact[2 * k + first];
+        }
+        return cosine ? sum : sum * r;
+    }
+
+    // atanh(z) for small z
+    static floating_type kernel_atanh(const SeriesTables& tables, const floating_type& z)
+    {
+        unsigned n = series_terms(z, 2) / 2 + 1;
+        floating_type z2 = z * z, sum = 0;
+        for (unsigned k = n + 1; k-- > 0; )
+        {
+            sum *= z2;
+            sum += tables.m_inv_odd[k];
+        }
+        return sum * z;
+    }
+
+    // above this |x| exp overflows or underflows anyway
+    static const long s_exp_max_arg = 1000000000L;
+
+    static floating_type exp_reduced(const SeriesTables& tables, const floating_type& f)
+    {
+        if (!b_mp::isfinite(f) || b_mp::abs(f) > s_exp_max_arg)
+            return b_mp::exp(f);
+
+        // f = k ln2 + j / steps + r, then exp(r) = (exp(r / 2^h))^(2^h)
+        // squared as expm1 to keep the small digits
+        long k = b_mp::lround(f * tables.m_inv_ln2);
+        floating_type r = f - tables.m_ln2 * k;
+        long j = b_mp::lround(r * s_exp_steps);
+        r -= floating_type(j) / s_exp_steps;
+        floating_type e = kernel_expm1(tables, b_mp::ldexp(r, -s_exp_halvings));
+        for (int i = 0; i < s_exp_halvings; ++i)
+            e *= e + 2;
+        e += 1;
+        e *= tables.m_exp[j + s_exp_table];
+        return b_mp::ldexp(e, static_cast<int>(k));
+    }
+
+    static floating_type log_reduced(const SeriesTables& tables, const floating_type& f)
+    {
+        if (f.sign() <= 0 || !b_mp::isfinite(f))
+            return b_mp::log(f);
+
+        // near 1: log f = 2 atanh((f - 1) / (f + 1)), exact in relative terms
+        floating_type d = f - 1;
+        if (b_mp::abs(d) < floating_type(1) / 64)
+            return 2 * kernel_atanh(tables, d / (f + 1));
+
+        // Halley on exp(y) = f from a double estimate; each step triples
+        // the correct digits
+        int e2;
+        floating_type m = b_mp::frexp(f, &e2);
+        floating_type y = std::log(m.convert_to<double>());
+        y += tables.m_ln2 * e2;
+        for (int i = 0; i < 4; ++i)
+        {
+            floating_type ey = exp_reduced(tables, y);
+            floating_type delta = 2 * (f - ey) / (f + ey);
+            y += delta;
+            if (b_mp::abs(delta) < floating_type("1e-40"))
+                break;
+        }
+        return y;
+    }
+
+    static floating_type sin_reduced(const SeriesTables& tables, const floating_type& f)
+    {
+        if (!b_mp::isfinite(f))
+            return b_mp::sin(f);
+        floating_type r;
+        switch (reduce_half_pi(r, f))
+        {
+        case 0:     return kernel_sincos(tables, r, false);
+        case 1:     return kernel_sincos(tables, r, true);
+        case 2:     return -kernel_sincos(tables, r, false);
+        default:    return -kernel_sincos(tables, r, true);
+        }
+    }
+
+    static floating_type cos_reduced(const SeriesTables& tables, const floating_type& f)
+    {
+        if (!b_mp::isfinite(f))
+            return b_mp::cos(f);
+        floating_type r;
+        switch (reduce_half_pi(r, f))
+        {
+        case 0:     return kernel_sincos(tables, r, true);
+        case 1:     return -kernel_sincos(tables, r, false);
+        case 2:     return -kernel_sincos(tables, r, true);
+        default:    return kernel_sincos(tables, r, false);
+        }
+    }
+
+    floating_type f_exp(const floating_type& f)
+    {
+        return exp_reduced(series_tables(), f);
+    }
+
+    floating_type f_log(const floating_type& f)
+    {
+        return log_reduced(series_tables(), f);
+    }
+
+    floating_type f_sin(const floating_type& f)
+    {
+        return sin_reduced(series_tables(), f);
+    }
+
+    floating_type f_cos(const floating_type& f)
+    {
+        return cos_reduced(series_tables(), f);
+    }
+
+    floating_type f_tan(const floating_type& f)
+    {
+        if (!b_mp::isfinite(f))
+            return b_mp::tan(f);
+        const SeriesTables& tables = series_tables();
+        floating_type r;
+        unsigned quadrant = reduce_half_pi(r, f);
+        floating_type s = kernel_sincos(tables, r, false);
+        floating_type c = kernel_sincos(tables, r, true);
+        if (quadrant % 2)
+            return -c / s;
+        return s / c;
+    }
+
+    floating_type f_log10(const floating_type& f)
+    {
+        if (f.sign() <= 0 || !b_mp::isfinite(f))
+            return b_mp::log10(f);
+        return f_log(f) / f_constant(CONSTANT_LN10);
+    }
+
+    //
+    // batch evaluation
+    //
+    enum BatchFunction { BATCH_EXP, BATCH_LOG, BATCH_SIN, BATCH_COS };
+
+    static void batch_range(BatchFunction fn, const vector_type& values,
+                            vector_type& out, size_t first, size_t last)
+    {
+        // the tables and constants are looked up once for the range
+        const SeriesTables& tables = series_tables();
+        for (size_t i = first; i < last; ++i)
+        {
+#ifndef PMP_DISABLE_VECTOR
+            if (values[i].is_v())
+            {
+                vector_type vec;
+                switch (fn)
+                {
+                case BATCH_EXP: exp_batch(values[i].get_v(), vec); break;
+                case BATCH_LOG: log_batch(values[i].get_v(), vec); break;
+                case BATCH_SIN: sin_batch(values[i].get_v(), vec); break;
+                case BATCH_COS: cos_batch(values[i].get_v(), vec); break;
+                }
+                out[i] = Number(vec);
+                continue;
+            }
+#endif
+            floating_type f = values[i].to_f();
+            switch (fn)
+            {
+            case BATCH_EXP: f = exp_reduced(tables, f); break;
+            case BATCH_LOG: f = log_reduced(tables, f); break;
+            case BATCH_SIN: f = sin_reduced(tables, f); break;
+            case BATCH_COS: f = cos_reduced(tables, f); break;
+            }
+            out[i] = Number(f);
+        }
+    }
+
+    static void batch(BatchFunction fn, const vector_type& values,
+                      vector_type& out, unsigned num_threads)
+    {
+        // out may alias values
+        vector_type result(values.size());
+        size_t n = values.size();
+#ifdef PMP_SINGLE_THREADED
+        num_threads = 1;    // the reference counts are not atomic
+#endif
+        if (num_threads < 1)
+            num_threads = 1;
+        if (num_threads > n)
+            num_threads = static_cast<unsigned>(n ? n : 1);
+        size_t chunk = (n + num_threads - 1) / num_threads;
+
+        std::vector<std::future<void> > tasks;
+        for (size_t first = chunk; first < n; first += chunk)
+        {
+            tasks.push_back(std::async(std::launch::async, batch_range, fn,
+                                       std::cref(values), std::ref(result),
+                                       first, std::min(first + chunk, n)));
+        }
+        batch_range(fn, values, result, 0, std::min(chunk, n));
+        for (size_t i = 0; i < tasks.size(); ++i)
+            tasks[i].get();
+        out.swap(result);
+    }
+
+    void exp_batch(const vector_type& values, vector_type& out,
+                   unsigned num_threads/* = 1*/)
+    {
+        batch(BATCH_EXP, values, out, num_threads);
+    }
+
+    void log_batch(const vector_type& values, vector_type& out,
+                   unsigned num_threads/* = 1*/)
+    {
+        batch(BATCH_LOG, values, out, num_threads);
+    }
+
+    void sin_batch(const vector_type& values, vector_type& out,
+                   unsigned num_threads/* = 1*/)
+    {
+        batch(BATCH_SIN, values, out, num_threads);
+    }
+
+    void cos_batch(const vector_type& values, vector_type& out,
+                   unsigned num_threads/* = 1*/)
+    {
+        batch(BATCH_COS, values, out, num_threads);
+    }
+
+    Number constant(ConstantType c)
+    {
+        return Number(f_constant(c));
+    }
+
+    Number constant(ConstantType c, size_t digits)
+    {
+        return Number(i_constant(c, digits), pow10(digits));
+    }
+} // namespace pmp
+
+/////////////////////////////////////////////////////////////////////////////
+
+namespace pmp
+{
+    Number::Inner *Number::Inner::parse(Type type, const std::string& str)
+    {
+        switch (type)
+        {
+        case INTEGER:
+            return create<integer_type>(INTEGER, str);
+
+        case FLOATING:
+            return create<floating_type>(FLOATING, str);
+
+        case RATIONAL:
+            return create<rational_type>(RATIONAL, str);
+
+#ifndef PMP_DISABLE_VECTOR
+        case VECTOR:
+            {
+                std::vector<std::string> strs;
+                pmp::split(str, ',', strs);
+                Inner *inner = create<vector_type>(VECTOR);
+                try
+                {
+                    for (size_t i = 0; i < strs.size(); ++i)
+                        inner->vector().push_back(Number(strs[i]));
+                }
+                catch (...)
+                {
+                    destroy(inner);
+                    throw;
+                }
+                return inner;
+            }
+#endif
+
+        default:
+            assert(0);
+            return create<integer_type>(INTEGER);
+        }
+    }
+
+    Number::Inner *Number::Inner::parse(const std::string& str)
+    {
+#ifndef PMP_DISABLE_VECTOR
+        if (str.find(',') != std::string::npos)
+            return parse(VECTOR, str);
+#endif
+        if (str.find('.') != std::string::npos ||
+            str.find("e+") != std::string::npos ||
+            str.find("e-") != std::string::npos)
+        {
+            return parse(FLOATING, str);
+        }
+        if (str.find('/') != std::string::npos)
+            return parse(RATIONAL, str);
+        return parse(INTEGER, str);
+    }
+
+    Number::Number(Type type, const std::string& str) :
+        m_inner(new_inner(type, str))
+    {
+    }
+
+    Number::Number(const std::string& str)
+    {
+#ifndef PMP_DISABLE_VECTOR
+        if (str.find(',') != std::string::npos)
+        {
+            m_inner = new_inner(VECTOR, str);
+        }
+        else
+#endif
+        if (str.find('.')  != std::string::npos ||
+            str.find("e+") != std::string::npos ||
+            str.find("e-") != std::string::npos)
+        {
+            m_inner = new_inner(FLOATING, str);
+        }
+        else if (str.find("/") != std::string::npos)
+        {
+            m_inner = new_inner(RATIONAL, str);
+        }
+        else
+        {
+            m_inner = new_inner(INTEGER, str);
+        }
+    }
+
+    void lazy_rational::reduce()
+    {
+        integer_type g = b_mp::gcd(num, den), r;
+        if (g == 1)
+            return;
+        i_divmod(num, r, num, g);
+        i_divmod(den, r, den, g);
+    }
+
+    bool Number::lazy_operands(const Number& num) const
+    {
+        if (!s_lazy_rational)
+            return false;
+        return (is_r() && (num.is_r() || num.is_i())) ||
+               (is_i() && num.is_r());
+    }
+
+    void Number::assign_lazy(const lazy_rational& q)
+    {
+        if (bit_size(q.num) > s_lazy_rational_bits ||
+            bit_size(q.den) > s_lazy_rational_bits)
+        {
+            lazy_rational reduced(q);
+            reduced.reduce();
+            m_inner = new_inner(reduced);
+        }
+        else
+        {
+            m_inner = new_inner(q);
+        }
+        if (s_auto_demote)
+            demote();
+    }
+
+    Number& Number::operator+=(const Number& num)
+    {
+#ifndef PMP_DISABLE_VECTOR
+        if (is_v() || num.is_v())
+        {
+            vector_type vec;
+            for (size_t i = 0; i < size(); ++i)
+            {
+                for (size_t j = 0; j < num.size(); ++j)
+                {
+                    Number tmp((*this)[i]);
+                    tmp += num[j];
+                    vec.push_back(tmp);
+                }
+            }
+            assign(vec);
+            return *this;
+        }
+#endif  // ndef PMP_DISABLE_VECTOR
+        if (lazy_operands(num))
+        {
+            assign_lazy(lazy_add(to_lazy(), num.to_lazy()));
+            return *this;
+        }
+        integer_type    i;
+        floating_type   f;
+        rational_type   r;
+        switch (type())
+        {
+        case Number::INTEGER:
+            switch (num.type())
+            {
+            case Number::INTEGER:
+                i = get_i();
+                i += num.get_i();
+                assign(i);
+                break;
+
+            case Number::FLOATING:
+                f = to_f();
+                f += num.get_f();
+                assign(f);
+                break;
+
+            case Number::RATIONAL:
+                r = to_r();
+                r += num.get_r();
+                assign(r);
+                break;
+
+            default:
+                assert(0);
+                break;
+            }
+            break;
+
+        case Number::FLOATING:
+            switch (num.type())
+            {
+            case Number::INTEGER:
+                f = get_f();
+                f += num.to_f();
+                assign(f);
+                break;
+
+            case Number::FLOATING:
+                f = get_f();
+                f += num.get_f();
+                assign(f);
+                break;
+
+            case Number::RATIONAL:
+                f = get_f();
+                f += num.to_f();
+                assign(f);
+                break;
+
+            default:
+                assert(0);
+                break;
+            }
+            break;
+
+        case Number::RATIONAL:
+            switch (num.type())
+            {
+            case Number::INTEGER:
+                r = get_r();
+                r += num.to_r();
+                assign(r);
+                break;
+
+            case Number::FLOATING:
+                f = to_f();
+                f += num.get_f();
+                assign(f);
+                break;
+
+            case Number::RATIONAL:
+                r = get_r();
+                r += num.get_r();
+                assign(r);
+                break;
+
+            default:
+                assert(0);
+                break;
+            }
+            break;
+
+        default:
+            assert(0);
+            break;
+        }
+        if (s_auto_demote)
+            demote();
+        return *this;
+    }
+
+    Number& Number::operator-=(const Number& num)
+    {
+#ifndef PMP_DISABLE_VECTOR
+        if (is_v() || num.is_v())
+        {
+            vector_type vec;
+            for (size_t i = 0; i < size(); ++i)
+            {
+                for (size_t j = 0; j < num.size(); ++j)
+                {
+                    Number tmp((*this)[i]);
+                    tmp -= num[j];
+                    vec.push_back(tmp);
+                }
+            }
+            assign(vec);
+            return *this;
+        }
+#endif
+        if (lazy_operands(num))
+        {
+            assign_lazy(lazy_sub(to_lazy(), num.to_lazy()));
+            return *this;
+        }
+        integer_type    i;
+        floating_type   f;
+        rational_type   r;
+        switch (type())
+        {
+        case Number::INTEGER:
+            switch (num.type())
+            {
+            case Number::INTEGER:
+                i = get_i();
+                i -= num.get_i();
+                assign(i);
+                break;
+
+            case Number::FLOATING:
+                f = floating_type(get_i());
+                f -= num.get_f();
+                assign(f);
+                break;
+
+            case Number::RATIONAL:
+                r = to_r();
+                r -= num.get_r();
+                assign(r);
+                break;
+
+            default:
+                assert(0);
+                break;
+            }
+            break;
+
+        case Number::FLOATING:
+            switch (num.type())
+            {
+            case Number::INTEGER:
+                f = get_f();
+                f -= num.to_f();
+                assign(f);
+                break;
+
+            case Number::FLOATING:
+                f = get_f();
+                f -= num.get_f();
+                assign(f);
+                break;
+
+            case Number::RATIONAL:
+                f = get_f();
+                f -= num.to_f();
+                assign(f);
+                break;
+
+            default:
+                assert(0);
+                break;
+            }
+            break;
+
+        case Number::RATIONAL:
+            switch (num.type())
+            {
+            case Number::INTEGER:
+                r = get_r();
+                r -= num.to_r();
+                assign(r);
+                break;
+
+            case Number::FLOATING:
+                f = to_f();
+                f -= num.to_f();
+                assign(f);
+                break;
+
+            case Number::RATIONAL:
+                r = get_r();
+                r -= num.get_r();
+                assign(r);
+                break;
+
+            default:
+                assert(0);
+                break;
+            }
+            break;
+
+        default:
+            assert(0);
+            break;
+        }
+        if (s_auto_demote)
+            demote();
+        return *this;
+    }
+
+    Number& Number::operator*=(const Number& num)
+    {
+#ifndef PMP_DISABLE_VECTOR
+        if (is_v() || num.is_v())
+        {
+            vector_type vec;
+            for (size_t i = 0; i < size(); ++i)
+            {
+                for (size_t j = 0; j < num.size(); ++j)
+                {
+                    Number tmp((*this)[i]);
+                    tmp *= num[j];
+                    vec.push_back(tmp);
+                }
+            }
+            assign(vec);
+            return *this;
+        }
+#endif
+        if (lazy_operands(num))
+        {
+            assign_lazy(lazy_mul(to_lazy(), num.to_lazy()));
+            return *this;
+        }
+        integer_type    i;
+        floating_type   f;
+        rational_type   r;
+        switch (type())
+        {
+        case Number::INTEGER:
+            switch (num.type())
+            {
+            case Number::INTEGER:
+                i_mul(i, get_i(), num.get_i());
+                assign(i);
+                break;
+
+            case Number::FLOATING:
+                f = to_f();
+                f *= num.get_f();
+                assign(f);
+                break;
+
+            case Number::RATIONAL:
+                r = to_r();
+                r *= num.get_r();
+                assign(r);
+                break;
+
+            default:
+                assert(0);
+                break;
+            }
+            break;
+
+        case Number::FLOATING:
+            switch (num.type())
+            {
+            case Number::INTEGER:
+                f = get_f();
+                f *= num.to_f();
+                assign(f);
+                break;
+
+            case Number::FLOATING:
+                f = get_f();
+                f *= num.get_f();
+                assign(f);
+                break;
+
+            case Number::RATIONAL:
+                f = get_f();
+                f *= num.to_f();
+                assign(f);
+                break;
+
+            default:
+                assert(0);
+                break;
+            }
+            break;
+
+        case Number::RATIONAL:
+            switch (num.type())
+            {
+            case Number::INTEGER:
+                r = get_r();
+                r *= num.to_r();
+                assign(r);
+                break;
+
+            case Number::FLOATING:
+                f = to_f();
+                f *= num.get_f();
+                assign(f);
+                break;
+
+            case Number::RATIONAL:
+                r = get_r();
+                r *= num.get_r();
+                assign(r);
+                break;
+
+            default:
+                assert(0);
+                break;
+            }
+            break;
+
+        default:
+            assert(0);
+            break;
+        }
+        if (s_auto_demote)
+            demote();
+        return *this;
+    }
+
+    Number& Number::operator/=(const Number& num)
+    {
+#ifndef PMP_DISABLE_VECTOR
+        if (is_v() || num.is_v())
+        {
+            vector_type vec;
+            for (size_t i = 0; i < size(); ++i)
+            {
+                for (size_t j = 0; j < num.size(); ++j)
+                {
+                    Number tmp((*this)[i]);
+                    tmp /= num[j];
+                    vec.push_back(tmp);
+                }
+            }
+            assign(vec);
+            return *this;
+        }
+#endif
+        if (!num.is_zero() &&
+            (lazy_operands(num) ||
+             (s_lazy_rational && s_intdiv_type == Number::RATIONAL &&
+              is_i() && num.is_i())))
+        {
+            assign_lazy(lazy_div(to_lazy(), num.to_lazy()));
+            return *this;
+        }
+        integer_type    i;
+        floating_type   f;
+        rational_type   r;
+        switch (type())
+        {
+        case Number::INTEGER:
+            switch (num.type())
+            {
+            case Number::INTEGER:
+                // one integer division gives the quotient and tells
+                // whether it is exact; division by zero keeps the
+                // behaviour of each mode
+                if (s_intdiv_type == Number::INTEGER)
+                {
+                    integer_type rem;
+                    i_divmod(i, rem, get_i(), num.get_i());
+                    assign(i);
+                }
+                else if (s_intdiv_type == Number::FLOATING)
+                {
+                    integer_type rem;
+                    if (!num.is_zero())
+                        i_divmod(i, rem, get_i(), num.get_i());
+                    if (num.is_zero() || !rem.is_zero())
+                    {
+                        f = to_f();
+                        f /= num.to_f();
+                        assign(f);
+                    }
+                    else
+                    {
+                        assign(i);
+                    }
+                }
+                else if (s_intdiv_type == Number::RATIONAL)
+                {
+                    integer_type rem;
+                    if (!num.is_zero())
+                        i_divmod(i, rem, get_i(), num.get_i());
+                    if (!num.is_zero() && rem.is_zero())
+                        r = rational_type(i);
+                    else
+                        r = rational_type(get_i(), num.get_i());
+                    assign(r);
+                }
+                else
+                {
+                    assert(0);
+                }
+                break;
+
+            case Number::FLOATING:
+                f = to_f();
+                f /= num.get_f();
+                assign(f);
+                break;
+
+            case Number::RATIONAL:
+                r = to_r();
+                r /= num.get_r();
+                assign(r);
+                break;
+
+            default:
+                assert(0);
+                break;
+            }
+            break;
+
+        case Number::FLOATING:
+            switch (num.type())
+            {
+            case Number::INTEGER:
+                f = get_f();
+                f /= num.to_f();
+                assign(f);
+                break;
+
+            case Number::FLOATING:
+                f = get_f();
+                f /= num.get_f();
+                assign(f);
+                break;
+
+            case Number::RATIONAL:
+                f = get_f();
+                f /= num.to_f();
+                assign(f);
+                break;
+
+            default:
+                assert(0);
+                break;
+            }
+            break;
+
+        case Number::RATIONAL:
+            switch (num.type())
+            {
+            case Number::INTEGER:
+                r = get_r();
+                r /= num.to_r();
+                assign(r);
+                break;
 
             case Number::FLOATING:
                 f = to_f();
-                f += num.get_f();
+                f /= num.get_f();
+                assign(f);
+                break;
+
+            case Number::RATIONAL:
+                r = get_r();
+                r /= num.get_r();
+                assign(r);
+                break;
+
+            default:
+                assert(0);
+                break;
+            }
+            break;
+
+        default:
+            assert(0);
+            break;
+        }
+        if (s_auto_demote)
+            demote();
+        return *this;
+    }
+
+    Number& Number::operator%=(const Number& num)
+    {
+#ifndef PMP_DISABLE_VECTOR
+        if (is_v() || num.is_v())
+        {
+            vector_type vec;
+            for (size_t i = 0; i < size(); ++i)
+            {
+                for (size_t j = 0; j < num.size(); ++j)
+                {
+                    Number tmp((*this)[i]);
+                    tmp %= num[j];
+                    vec.push_back(tmp);
+                }
+            }
+            assign(vec);
+            return *this;
+        }
+#endif
+        integer_type    i;
+        floating_type   f;
+        rational_type   r;
+        switch (type())
+        {
+        case Number::INTEGER:
+            switch (num.type())
+            {
+            case Number::INTEGER:
+                {
+                    integer_type quot;
+                    i_divmod(quot, i, get_i(), num.get_i());
+                    assign(i);
+                }
+                break;
+
+            case Number::FLOATING:
+                f = to_f();
+                f = b_mp::fmod(f, num.get_f());
+                assign(f);
+                break;
+
+            default:
+                assert(0);
+                break;
+            }
+            break;
+
+        case Number::FLOATING:
+            switch (num.type())
+            {
+            case Number::INTEGER:
+                f = get_f();
+                f = b_mp::fmod(f, static_cast<floating_type>(num.get_i()));
+                assign(f);
+                break;
+
+            case Number::FLOATING:
+                f = get_f();
+                f = b_mp::fmod(f, num.get_f());
                 assign(f);
                 break;
 
-            case Number::RATIONAL:
-                r = get_r();
-                r += num.get_r();
-                assign(r);
-                break;
+            default:
+                assert(0);
+                break;
+            }
+            break;
+
+        default:
+            assert(0);
+            break;
+        }
+        if (s_auto_demote)
+            demote();
+        return *this;
+    }
+
+    //
+    // out-parameter arithmetic
+    //
+    integer_type *Number::reuse_i()
+    {
+        Inner *inner = m_inner.get();
+        if (inner->m_type != INTEGER || inner->m_interned || inner->m_refs != 1)
+            return NULL;
+        inner->m_hash.store(0, std::memory_order_relaxed);
+        return &inner->integer();
+    }
+
+    floating_type *Number::reuse_f()
+    {
+        Inner *inner = m_inner.get();
+        if (inner->m_type != FLOATING || inner->m_interned || inner->m_refs != 1)
+            return NULL;
+        inner->m_hash.store(0, std::memory_order_relaxed);
+        return &inner->floating();
+    }
+
+    rational_type *Number::reuse_r()
+    {
+        Inner *inner = m_inner.get();
+        if (inner->m_type != RATIONAL || inner->m_lazy || inner->m_refs != 1)
+            return NULL;
+        inner->m_hash.store(0, std::memory_order_relaxed);
+        return inner->m_rational.load(std::memory_order_relaxed);
+    }
+
+    static inline bool is_scalar(const Number& num)
+    {
+        return num.is_i() || num.is_f() || num.is_r();
+    }
+
+    // the type of a + b, a - b, a * b and a / b when it can be computed in
+    // place; false for vectors and lazy rationals, left to the operators
+    static bool arith_type(Number::Type& type, const Number& a, const Number& b)
+    {
+        if (!is_scalar(a) || !is_scalar(b))
+            return false;
+        if (a.is_f() || b.is_f())
+            type = Number::FLOATING;
+        else if (a.is_r() || b.is_r())
+            type = Number::RATIONAL;
+        else
+            type = Number::INTEGER;
+        return !(s_lazy_rational && type == Number::RATIONAL);
+    }
+
+    struct AddOp
+    {
+        template <typename T>
+        static void apply(T& out, const T& x, const T& y) { out = x + y; }
+    };
+
+    struct SubOp
+    {
+        template <typename T>
+        static void apply(T& out, const T& x, const T& y) { out = x - y; }
+    };
+
+    struct MulOp
+    {
+        template <typename T>
+        static void apply(T& out, const T& x, const T& y) { out = x * y; }
+
+        static void apply(integer_type& out, const integer_type& x,
+                          const integer_type& y)
+        {
+            i_mul(out, x, y);
+        }
+    };
+
+    struct DivOp
+    {
+        template <typename T>
+        static void apply(T& out, const T& x, const T& y) { out = x / y; }
+    };
+
+    // Boost's expression templates and i_mul cope with out being x or y
+    template <typename Op>
+    static bool arith_in_place(Number& out, const Number& a, const Number& b)
+    {
+        Number::Type type;
+        if (!arith_type(type, a, b))
+            return false;
+
+        switch (type)
+        {
+        case Number::INTEGER:
+            if (integer_type *i = out.reuse_i())
+            {
+                Op::apply(*i, a.get_i(), b.get_i());
+                return true;
+            }
+            break;
+
+        case Number::FLOATING:
+            if (floating_type *f = out.reuse_f())
+            {
+                if (a.is_f() && b.is_f())
+                    Op::apply(*f, a.get_f(), b.get_f());
+                else
+                    Op::apply(*f, a.to_f(), b.to_f());
+                if (s_auto_demote)
+                    out.demote();
+                return true;
+            }
+            break;
+
+        case Number::RATIONAL:
+            if (rational_type *r = out.reuse_r())
+            {
+                if (a.is_r() && b.is_r())
+                    Op::apply(*r, a.get_r(), b.get_r());
+                else
+                    Op::apply(*r, a.to_r(), b.to_r());
+                if (s_auto_demote)
+                    out.demote();
+                return true;
+            }
+            break;
+
+        default:
+            break;
+        }
+        return false;
+    }
+
+    void add(Number& out, const Number& a, const Number& b)
+    {
+        if (!arith_in_place<AddOp>(out, a, b))
+            out = a + b;
+    }
+
+    void sub(Number& out, const Number& a, const Number& b)
+    {
+        if (!arith_in_place<SubOp>(out, a, b))
+            out = a - b;
+    }
+
+    void mul(Number& out, const Number& a, const Number& b)
+    {
+        if (!arith_in_place<MulOp>(out, a, b))
+            out = a * b;
+    }
+
+    void div(Number& out, const Number& a, const Number& b)
+    {
+        // an integer quotient depends on SetIntDivType; leave it to the
+        // operator
+        if ((a.is_i() && b.is_i()) || !arith_in_place<DivOp>(out, a, b))
+            out = a / b;
+    }
+
+    void fma(Number& out, const Number& a, const Number& b, const Number& c)
+    {
+        Number::Type type1, type2;
+        if (arith_type(type1, a, b) && arith_type(type2, c, c))
+        {
+            if (type1 == Number::INTEGER && type2 == Number::INTEGER)
+            {
+                if (integer_type *i = out.reuse_i())
+                {
+                    if (i == &c.get_i())
+                    {
+                        integer_type t;
+                        i_mul(t, a.get_i(), b.get_i());
+                        *i += t;
+                    }
+                    else
+                    {
+                        i_mul(*i, a.get_i(), b.get_i());
+                        *i += c.get_i();
+                    }
+                    return;
+                }
+            }
+            else if (type1 == Number::FLOATING || type2 == Number::FLOATING)
+            {
+                if (floating_type *f = out.reuse_f())
+                {
+                    *f = a.to_f() * b.to_f() + c.to_f();
+                    if (s_auto_demote)
+                        out.demote();
+                    return;
+                }
+            }
+        }
+        out = a * b + c;
+    }
+
+    void divmod(Number& q, Number& r, const Number& a, const Number& b)
+    {
+        assert(&q != &r);
+        if (!is_scalar(a) || !is_scalar(b))
+            throw std::domain_error("pmp::divmod: vector operand");
+
+        if (a.is_i() && b.is_i())
+        {
+            integer_type *qi = q.reuse_i(), *ri = r.reuse_i();
+            if (qi && ri)
+            {
+                i_divmod(*qi, *ri, a.get_i(), b.get_i());
+            }
+            else
+            {
+                integer_type quot, rem;
+                i_divmod(quot, rem, a.get_i(), b.get_i());
+                q.assign(quot);
+                r.assign(rem);
+            }
+        }
+        else if (a.is_f() || b.is_f())
+        {
+            floating_type x = a.to_f(), y = b.to_f();
+            floating_type quot = b_mp::trunc(x / y);
+            floating_type rem = x - quot * y;
+            floating_type *qf = q.reuse_f(), *rf = r.reuse_f();
+            if (qf)
+                *qf = quot;
+            else
+                q.assign(quot);
+            if (rf)
+                *rf = rem;
+            else
+                r.assign(rem);
+        }
+        else
+        {
+            // exact: the quotient of the rationals truncated
+            rational_type x = a.to_r(), y = b.to_r();
+            rational_type ratio = x / y;
+            integer_type quot = b_mp::numerator(ratio) / b_mp::denominator(ratio);
+            rational_type rem = x - rational_type(quot) * y;
+            q.assign(quot);
+            r.assign(rem);
+        }
+    }
+
+    //
+    // serialization
+    //
+    // A version byte (1), then one value, a tag byte and its body:
+    //   0  integer: varint(limb count << 1 | sign), then that many 64-bit
+    //      limbs of the magnitude, least significant first, little-endian
+    //   1  floating: varint(class << 1 | sign), class 0 finite, 1 infinite,
+    //      2 NaN; a finite value goes on with varint(digits10), zigzag
+    //      varint(e), varint(n) and n base 10^8 limbs as varints, most
+    //      significant first; limb k is worth 10^(8 * (e - k))
+    //   2  rational: numerator and denominator as integer values
+    //   3  vector: varint(size), then the values
+    //   4  integer of at most 63 bits: zigzag varint(value)
+    // Varints hold 7 bits per byte, least significant first, the top bit
+    // set on all bytes but the last.
+    //
+    enum SerialTag
+    {
+        SERIAL_INTEGER, SERIAL_FLOATING, SERIAL_RATIONAL, SERIAL_VECTOR,
+        SERIAL_SMALL_INTEGER
+    };
+
+    static const unsigned char s_serial_version = 1;
+    static const unsigned s_serial_max_depth = 256;     // nested values
+    static const unsigned long long s_limb10 = 100000000ULL;    // 10^8
+
+    static void put_varint(std::string& out, unsigned long long n)
+    {
+        char buf[10];
+        size_t len = 0;
+        while (n >= 0x80)
+        {
+            buf[len++] = static_cast<char>((n & 0x7F) | 0x80);
+            n >>= 7;
+        }
+        buf[len++] = static_cast<char>(n);
+        out.append(buf, len);
+    }
+
+    static void serial_error()
+    {
+        throw std::domain_error("pmp::Number::deserialize: bad data");
+    }
+
+    static unsigned long long get_varint(const char *& p, const char *last)
+    {
+        unsigned long long n = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7)
+        {
+            if (p == last)
+                serial_error();
+            unsigned char byte = static_cast<unsigned char>(*p++);
+            n |= static_cast<unsigned long long>(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return n;
+        }
+        serial_error();
+        return 0;
+    }
+
+    static inline unsigned long long zigzag(__int64 n)
+    {
+        return (static_cast<unsigned long long>(n) << 1) ^
+               static_cast<unsigned long long>(n >> 63);
+    }
+
+    static inline __int64 unzigzag(unsigned long long n)
+    {
+        return static_cast<__int64>(n >> 1) ^ -static_cast<__int64>(n & 1);
+    }
 
-            default:
-                assert(0);
-                break;
-            }
-            break;
+    static void serialize_i(std::string& out, const integer_type& i)
+    {
+        static const __int64 s_small = 0x7FFFFFFFFFFFFFFFLL;
+        if (limb_count(i) * sizeof(limb_type) <= 8 && -s_small <= i && i <= s_small)
+        {
+            out += static_cast<char>(SERIAL_SMALL_INTEGER);
+            put_varint(out, zigzag(static_cast<__int64>(i)));
+            return;
+        }
 
-        default:
-            assert(0);
-            break;
+        const limb_type *limbs = i.backend().limbs();
+        size_t n = limb_count(i);
+        size_t count = (n * sizeof(limb_type) + 7) / 8;
+        out += static_cast<char>(SERIAL_INTEGER);
+        put_varint(out, (static_cast<unsigned long long>(count) << 1) |
+                        (i.sign() < 0 ? 1 : 0));
+        size_t pos = out.size();
+        out.resize(pos + count * 8);
+        char *dest = &out[pos];
+        for (size_t k = 0; k < n; ++k)
+        {
+            limb_type limb = limbs[k];
+            for (size_t b = 0; b < sizeof(limb_type); ++b)
+            {
+                *dest++ = static_cast<char>(limb & 0xFF);
+                limb >>= 8;
+            }
         }
-        return *this;
+        std::fill(dest, &out[pos] + count * 8, '\0');
     }
 
-    Number& Number::operator-=(const Number& num)
+    static const char *deserialize_i(integer_type& i, const char *p,
+                                     const char *last)
     {
-#ifndef PMP_DISABLE_VECTOR
-        if (is_v() || num.is_v())
+        unsigned long long head = get_varint(p, last);
+        unsigned long long count = head >> 1;
+        if (count > static_cast<unsigned long long>(last - p) / 8)
+            serial_error();
+        size_t bytes = static_cast<size_t>(count) * 8;
+        size_t n = (bytes + sizeof(limb_type) - 1) / sizeof(limb_type);
+        if (n == 0)
         {
-            vector_type vec;
-            for (size_t i = 0; i < size(); ++i)
+            i = 0;
+            return p;
+        }
+        i.backend().resize(static_cast<unsigned>(n), static_cast<unsigned>(n));
+        if (i.backend().size() < n)
+            serial_error();     // beyond the largest integer
+        limb_type *limbs = i.backend().limbs();
+        for (size_t k = 0; k < n; ++k)
+        {
+            limb_type limb = 0;
+            for (size_t b = sizeof(limb_type); b-- > 0; )
             {
-                for (size_t j = 0; j < num.size(); ++j)
-                {
-                    Number tmp((*this)[i]);
-                    tmp -= num[j];
-                    vec.push_back(tmp);
-                }
+                limb <<= 8;
+                limb |= static_cast<unsigned char>(p[k * sizeof(limb_type) + b]);
             }
-            assign(vec);
-            return *this;
+            limbs[k] = limb;
         }
-#endif
-        integer_type    i;
-        floating_type   f;
-        rational_type   r;
-        switch (type())
+        i.backend().sign(false);
+        i.backend().normalize();
+        if (head & 1)
+            i.backend().negate();
+        return p + bytes;
+    }
+
+#if BOOST_VERSION >= 106000
+    // cpp_dec_float hands its limbs, exponent, sign and class to any
+    // archive through its serialize() member; these two archives copy
+    // them out and back in
+    struct DecFloatParts
+    {
+        enum { s_max_limbs = floating_type::backend_type::cpp_dec_float_total_digits10 / 8 };
+        unsigned long long  m_limbs[s_max_limbs];
+        size_t              m_count;
+        __int64             m_exp;
+        bool                m_neg;
+        int                 m_class;
+    };
+
+    class DecFloatSaver
+    {
+    public:
+        DecFloatSaver(DecFloatParts& parts) : m_parts(parts)
         {
-        case Number::INTEGER:
-            switch (num.type())
+            m_parts.m_count = 0;
+        }
+
+        template <typename T>
+        DecFloatSaver& operator&(const boost::serialization::nvp<T>& v)
+        {
+            switch (v.name()[0])
             {
-            case Number::INTEGER:
-                i = get_i();
-                i -= num.get_i();
-                assign(i);
+            case 'd':   // digit
+                if (m_parts.m_count < DecFloatParts::s_max_limbs)
+                    m_parts.m_limbs[m_parts.m_count++] = static_cast<unsigned long long>(v.value());
                 break;
-
-            case Number::FLOATING:
-                f = floating_type(get_i());
-                f -= num.get_f();
-                assign(f);
+            case 'e':   // exponent
+                m_parts.m_exp = static_cast<__int64>(v.value());
                 break;
-
-            case Number::RATIONAL:
-                r = to_r();
-                r -= num.get_r();
-                assign(r);
+            case 's':   // sign
+                m_parts.m_neg = (v.value() != 0);
                 break;
-
-            default:
-                assert(0);
+            case 'c':   // class-type
+                m_parts.m_class = static_cast<int>(v.value());
                 break;
             }
-            break;
+            return *this;
+        }
 
-        case Number::FLOATING:
-            switch (num.type())
+    protected:
+        DecFloatParts& m_parts;
+    };
+
+    class DecFloatLoader
+    {
+    public:
+        DecFloatLoader(const DecFloatParts& parts) : m_parts(parts), m_index(0)
+        {
+        }
+
+        template <typename T>
+        DecFloatLoader& operator&(const boost::serialization::nvp<T>& v)
+        {
+            switch (v.name()[0])
             {
-            case Number::INTEGER:
-                f = get_f();
-                f -= num.to_f();
-                assign(f);
+            case 'd':
+                v.value() = static_cast<T>(m_index < m_parts.m_count ? m_parts.m_limbs[m_index] : 0);
+                ++m_index;
                 break;
-
-            case Number::FLOATING:
-                f = get_f();
-                f -= num.get_f();
-                assign(f);
+            case 'e':
+                v.value() = static_cast<T>(m_parts.m_exp);
                 break;
-
-            case Number::RATIONAL:
-                f = get_f();
-                f -= num.to_f();
-                assign(f);
+            case 's':
+                v.value() = static_cast<T>(m_parts.m_neg);
                 break;
-
-            default:
-                assert(0);
+            case 'c':
+                v.value() = static_cast<T>(m_parts.m_class);
                 break;
-            }
-            break;
+            }   // the precision stays
+            return *this;
+        }
 
-        case Number::RATIONAL:
-            switch (num.type())
+    protected:
+        const DecFloatParts&    m_parts;
+        size_t                  m_index;
+    };
+
+    static void serialize_f(std::string& out, const floating_type& f)
+    {
+        DecFloatParts parts;
+        DecFloatSaver saver(parts);
+        const_cast<floating_type&>(f).backend().serialize(saver, 0);
+
+        out += static_cast<char>(SERIAL_FLOATING);
+        put_varint(out, (static_cast<unsigned long long>(parts.m_class) << 1) |
+                        (parts.m_neg ? 1 : 0));
+        if (parts.m_class != 0)
+            return;
+
+        size_t n = parts.m_count;
+        while (n > 0 && parts.m_limbs[n - 1] == 0)
+            --n;
+        assert(parts.m_exp % 8 == 0);
+        put_varint(out, std::numeric_limits<floating_type>::digits10);
+        put_varint(out, zigzag(n ? parts.m_exp / 8 : 0));
+        put_varint(out, n);
+        for (size_t k = 0; k < n; ++k)
+            put_varint(out, parts.m_limbs[k]);
+    }
+
+    static const char *deserialize_f(floating_type& f, const char *p,
+                                     const char *last)
+    {
+        typedef floating_type::backend_type backend_type;
+
+        DecFloatParts parts;
+        unsigned long long head = get_varint(p, last);
+        parts.m_neg = (head & 1) != 0;
+        parts.m_class = static_cast<int>(head >> 1);
+        parts.m_count = 0;
+        parts.m_exp = 0;
+        if (parts.m_class > 2)
+            serial_error();
+        if (parts.m_class == 0)
+        {
+            get_varint(p, last);    // digits10 of the writer
+            __int64 e = unzigzag(get_varint(p, last));
+            unsigned long long n = get_varint(p, last);
+            if (n > static_cast<unsigned long long>(last - p) ||
+                e > backend_type::cpp_dec_float_max_exp10 / 8 ||
+                e < backend_type::cpp_dec_float_min_exp10 / 8)
             {
-            case Number::INTEGER:
-                r = get_r();
-                r -= num.to_r();
-                assign(r);
-                break;
+                serial_error();
+            }
+            for (unsigned long long k = 0; k < n; ++k)
+            {
+                unsigned long long limb = get_varint(p, last);
+                if (limb >= s_limb10 || (k == 0 && limb == 0))
+                    serial_error();
+                if (k < DecFloatParts::s_max_limbs)
+                    parts.m_limbs[parts.m_count++] = limb;  // drops extra precision
+            }
+            parts.m_exp = 8 * e;
+            if (n == 0)
+                parts.m_neg = false;
+        }
 
-            case Number::FLOATING:
-                f = to_f();
-                f -= num.to_f();
-                assign(f);
-                break;
+        DecFloatLoader loader(parts);
+        f.backend().serialize(loader, 0);
+        return p;
+    }
+#else   // BOOST_VERSION < 106000
+    // f *= 10^(8 * n) by the backend's single-limb multiply, 10^4 at a
+    // time; f must leave n limbs free, which each caller below does
+    static inline void mul_limbs(floating_type& f, int n)
+    {
+        for (int k = 0; k < 2 * n; ++k)
+            f.backend().mul_unsigned_long_long(10000);
+    }
 
-            case Number::RATIONAL:
-                r = get_r();
-                r -= num.get_r();
-                assign(r);
-                break;
+    static void serialize_f(std::string& out, const floating_type& f)
+    {
+        typedef floating_type::backend_type backend_type;
 
-            default:
-                assert(0);
-                break;
-            }
-            break;
+        out += static_cast<char>(SERIAL_FLOATING);
+        if (b_mp::isnan(f))
+        {
+            put_varint(out, 2 << 1);
+            return;
+        }
+        unsigned sign = (f.sign() < 0 ? 1 : 0);
+        if (b_mp::isinf(f))
+        {
+            put_varint(out, (1 << 1) | sign);
+            return;
+        }
+        put_varint(out, sign);
+        put_varint(out, std::numeric_limits<floating_type>::digits10);
+        if (f.is_zero())
+        {
+            put_varint(out, 0);
+            put_varint(out, 0);
+            return;
+        }
 
-        default:
-            assert(0);
-            break;
+        // the backend keeps base 10^8 limbs with the leading one worth
+        // 10^(8 * e); scaling by powers of 10^8 only moves the exponent
+        floating_type g = b_mp::abs(f);
+        long order = static_cast<long>(g.backend().order());
+        long e = (order >= 0 ? order / 8 : -((7 - order) / 8));
+        g *= floating_type(backend_type(1.0, static_cast<int>(8 - 8 * e)));
+
+        unsigned long long limbs[backend_type::cpp_dec_float_total_digits10 / 8 + 1];
+        size_t n = 0;
+        while (!g.is_zero() && n + 2 <= sizeof(limbs) / sizeof(limbs[0]))
+        {
+            floating_type two = b_mp::trunc(g);     // two limbs
+            unsigned long long v = two.backend().extract_unsigned_long_long();
+            limbs[n++] = v / s_limb10;
+            limbs[n++] = v % s_limb10;
+            g -= two;
+            mul_limbs(g, 2);
         }
-        return *this;
+        while (n > 0 && limbs[n - 1] == 0)
+            --n;
+
+        put_varint(out, zigzag(e));
+        put_varint(out, n);
+        for (size_t k = 0; k < n; ++k)
+            put_varint(out, limbs[k]);
     }
 
-    Number& Number::operator*=(const Number& num)
+    static const char *deserialize_f(floating_type& f, const char *p,
+                                     const char *last)
     {
-#ifndef PMP_DISABLE_VECTOR
-        if (is_v() || num.is_v())
+        typedef floating_type::backend_type backend_type;
+
+        unsigned long long head = get_varint(p, last);
+        bool neg = (head & 1) != 0;
+        switch (head >> 1)
         {
-            vector_type vec;
-            for (size_t i = 0; i < size(); ++i)
+        case 0:
+            break;
+        case 1:
+            f = std::numeric_limits<floating_type>::infinity();
+            if (neg)
+                f = -f;
+            return p;
+        case 2:
+            f = std::numeric_limits<floating_type>::quiet_NaN();
+            return p;
+        default:
+            serial_error();
+        }
+
+        get_varint(p, last);    // digits10 of the writer
+        __int64 e = unzigzag(get_varint(p, last));
+        unsigned long long n = get_varint(p, last);
+        if (n > static_cast<unsigned long long>(last - p))
+            serial_error();
+
+        // two limbs at a time, each step exact
+        f = 0;
+        for (unsigned long long k = 0; k < n; k += 2)
+        {
+            unsigned long long v = get_varint(p, last);
+            if (k + 1 < n)
             {
-                for (size_t j = 0; j < num.size(); ++j)
-                {
-                    Number tmp((*this)[i]);
-                    tmp *= num[j];
-                    vec.push_back(tmp);
-                }
+                v *= s_limb10;
+                v += get_varint(p, last);
+                mul_limbs(f, 2);
             }
-            assign(vec);
-            return *this;
+            else
+            {
+                mul_limbs(f, 1);
+            }
+            f += v;
         }
-#endif
-        integer_type    i;
-        floating_type   f;
-        rational_type   r;
+        if (n > 0)
+        {
+            __int64 shift = 8 * (e - static_cast<__int64>(n) + 1);
+            if (shift != static_cast<int>(shift))
+                serial_error();
+            f *= floating_type(backend_type(1.0, static_cast<int>(shift)));
+        }
+        if (neg)
+            f = -f;
+        return p;
+    }
+#endif  // BOOST_VERSION < 106000
+
+    void Number::serialize(std::string& out) const
+    {
+        out += static_cast<char>(s_serial_version);
+        serialize_value(out);
+    }
+
+    void Number::serialize_value(std::string& out) const
+    {
         switch (type())
         {
         case Number::INTEGER:
-            switch (num.type())
+            serialize_i(out, get_i());
+            break;
+
+        case Number::FLOATING:
+            serialize_f(out, get_f());
+            break;
+
+        case Number::RATIONAL:
             {
-            case Number::INTEGER:
-                i = get_i();
-                i *= num.get_i();
-                assign(i);
-                break;
+                const rational_type& r = get_r();
+                out += static_cast<char>(SERIAL_RATIONAL);
+                serialize_i(out, b_mp::numerator(r));
+                serialize_i(out, b_mp::denominator(r));
+            }
+            break;
 
-            case Number::FLOATING:
-                f = to_f();
-                f *= num.get_f();
-                assign(f);
-                break;
+#ifndef PMP_DISABLE_VECTOR
+        case Number::VECTOR:
+            out += static_cast<char>(SERIAL_VECTOR);
+            put_varint(out, get_v().size());
+            for (size_t i = 0; i < get_v().size(); ++i)
+                get_v()[i].serialize_value(out);
+            break;
+#endif
 
-            case Number::RATIONAL:
-                r = to_r();
-                r *= num.get_r();
-                assign(r);
-                break;
+        default:
+            assert(0);
+            break;
+        }
+    }
 
-            default:
-                assert(0);
-                break;
+    size_t Number::deserialize(const char *data, size_t size)
+    {
+        if (size == 0 || static_cast<unsigned char>(data[0]) != s_serial_version)
+            serial_error();
+        return deserialize_value(data + 1, data + size, 0) - data;
+    }
+
+    const char *Number::deserialize_value(const char *p, const char *last,
+                                          unsigned depth)
+    {
+        if (p == last || depth > s_serial_max_depth)
+            serial_error();
+        switch (static_cast<unsigned char>(*p++))
+        {
+        case SERIAL_SMALL_INTEGER:
+            {
+                __int64 n = unzigzag(get_varint(p, last));
+                integer_type *i = reuse_i();
+                if (i)
+                    *i = n;
+                else
+                    *this = Number(n);
             }
             break;
 
-        case Number::FLOATING:
-            switch (num.type())
+        case SERIAL_INTEGER:
+            if (integer_type *i = reuse_i())
             {
-            case Number::INTEGER:
-                f = get_f();
-                f *= num.to_f();
-                assign(f);
-                break;
-
-            case Number::FLOATING:
-                f = get_f();
-                f *= num.get_f();
-                assign(f);
-                break;
-
-            case Number::RATIONAL:
-                f = get_f();
-                f *= num.to_f();
-                assign(f);
-                break;
+                p = deserialize_i(*i, p, last);
+            }
+            else
+            {
+                integer_type i2;
+                p = deserialize_i(i2, p, last);
+                m_inner = new_inner(i2);
+            }
+            break;
 
-            default:
-                assert(0);
-                break;
+        case SERIAL_FLOATING:
+            if (floating_type *f = reuse_f())
+            {
+                p = deserialize_f(*f, p, last);
+            }
+            else
+            {
+                floating_type f2;
+                p = deserialize_f(f2, p, last);
+                m_inner = new_inner(f2);
             }
             break;
 
-        case Number::RATIONAL:
-            switch (num.type())
+        case SERIAL_RATIONAL:
             {
-            case Number::INTEGER:
-                r = get_r();
-                r *= num.to_r();
-                assign(r);
-                break;
-
-            case Number::FLOATING:
-                f = to_f();
-                f *= num.get_f();
-                assign(f);
-                break;
-
-            case Number::RATIONAL:
-                r = get_r();
-                r *= num.get_r();
-                assign(r);
-                break;
+                Number num, den;
+                p = num.deserialize_value(p, last, depth + 1);
+                p = den.deserialize_value(p, last, depth + 1);
+                if (!num.is_i() || !den.is_i() || den.get_i().sign() <= 0)
+                    serial_error();
+                rational_type *r = reuse_r();
+                if (r)
+                    *r = rational_type(num.get_i(), den.get_i());
+                else
+                    m_inner = new_inner(num.get_i(), den.get_i());
+            }
+            break;
 
-            default:
-                assert(0);
-                break;
+#ifndef PMP_DISABLE_VECTOR
+        case SERIAL_VECTOR:
+            {
+                unsigned long long size = get_varint(p, last);
+                if (size > static_cast<unsigned long long>(last - p))
+                    serial_error();     // every value takes a byte or more
+                if (!is_v() || m_inner->m_refs != 1)
+                    m_inner = new_inner(vector_type());
+                vector_type& vec = get_v();
+                vec.resize(static_cast<size_t>(size));
+                for (size_t i = 0; i < vec.size(); ++i)
+                    p = vec[i].deserialize_value(p, last, depth + 1);
             }
             break;
+#endif
 
         default:
-            assert(0);
+            serial_error();
             break;
         }
-        return *this;
+        return p;
     }
 
-    Number& Number::operator/=(const Number& num)
+    //
+    // native arrays
+    //
+    // The loops read the representation where that is cheap: integers of
+    // up to 64 bits, the leading limbs of a floating, and rationals whose
+    // terms fit 53 bits.  The rest goes through convert_to and range
+    // checks, which give the same values more slowly.
+    //
+
+    static const unsigned long long s_exact_double = 1ULL << 53;
+    static const unsigned long long s_int64_limit = 1ULL << 63;
+
+    // |i| if it fits 64 bits
+    static inline bool i_to_u64(const integer_type& i, unsigned long long& mag)
     {
-#ifndef PMP_DISABLE_VECTOR
-        if (is_v() || num.is_v())
+        unsigned n = i.backend().size();
+        if (n * sizeof(limb_type) > sizeof(mag))
+            return false;
+        const limb_type *p = i.backend().limbs();
+        mag = p[0];
+        if (n > 1)
+            mag |= static_cast<unsigned long long>(p[1]) << (s_limb_bits & 63);
+        return true;
+    }
+
+    static inline __int64 clamp_int64(bool neg, unsigned long long mag,
+                                      size_t& overflows)
+    {
+        if (neg)
         {
-            vector_type vec;
-            for (size_t i = 0; i < size(); ++i)
+            if (mag > s_int64_limit)
             {
-                for (size_t j = 0; j < num.size(); ++j)
-                {
-                    Number tmp((*this)[i]);
-                    tmp /= num[j];
-                    vec.push_back(tmp);
-                }
+                ++overflows;
+                mag = s_int64_limit;
             }
-            assign(vec);
-            return *this;
+            return mag ? -static_cast<__int64>(mag - 1) - 1 : 0;
         }
-#endif
-        integer_type    i;
-        floating_type   f;
-        rational_type   r;
-        switch (type())
+        if (mag >= s_int64_limit)
         {
-        case Number::INTEGER:
-            switch (num.type())
+            ++overflows;
+            mag = s_int64_limit - 1;
+        }
+        return static_cast<__int64>(mag);
+    }
+
+    static __int64 i_to_int64(const integer_type& i, size_t& overflows)
+    {
+        unsigned long long mag;
+        if (!i_to_u64(i, mag))
+            mag = ~0ULL;    // clamped all the same
+        return clamp_int64(i.sign() < 0, mag, overflows);
+    }
+
+    // f.convert_to<double>() rounds f to 19 digits, half to even, and
+    // reads them back with strtod.  This does the same from the limbs,
+    // without the text round-trip when the digits are exact in a double.
+    static double f_to_double(const floating_type& f)
+    {
+#if BOOST_VERSION >= 106000
+        DecFloatParts parts;
+        DecFloatSaver saver(parts);
+        const_cast<floating_type&>(f).backend().serialize(saver, 0);
+        if (parts.m_class == 0 && parts.m_count > 0)
+        {
+            if (parts.m_limbs[0] == 0)
+                return 0.0;
+
+            // the first 25 digits or more; the first limb is worth 10^exp
+            char digits[8 * 4];
+            size_t len = 0;
+            for (size_t k = 0; k < 4; ++k)
             {
-            case Number::INTEGER:
-                if (s_intdiv_type == Number::INTEGER)
+                unsigned long long limb = (k < parts.m_count ? parts.m_limbs[k] : 0);
+                for (size_t j = 8; j-- > 0; )
                 {
-                    i = get_i();
-                    i /= num.get_i();
-                    assign(i);
+                    digits[len + j] = static_cast<char>('0' + limb % 10);
+                    limb /= 10;
                 }
-                else if (s_intdiv_type == Number::FLOATING)
+                len += 8;
+            }
+            size_t lead = 0;
+            while (digits[lead] == '0')
+                ++lead;
+            __int64 order = parts.m_exp + 7 - static_cast<__int64>(lead);
+
+            // beyond about 10^300 either way, leave the limits of double
+            // to convert_to
+            if (-300 <= order && order <= 300)
+            {
+                unsigned long long m = 0;
+                const char *p = digits + lead;
+                for (size_t j = 0; j < 19; ++j)
+                    m = m * 10 + (p[j] - '0');
+                bool up = (p[19] > '5');
+                if (p[19] == '5')
                 {
-                    if (b_mp::fmod(to_f(), num.to_f()) != 0)
-                    {
-                        f = to_f();
-                        f /= num.to_f();
-                        assign(f);
-                    }
-                    else
-                    {
-                        i = get_i();
-                        i /= num.get_i();
-                        assign(i);
-                    }
+                    up = (m & 1) != 0;
+                    for (const char *q = p + 20; !up && q < digits + len; ++q)
+                        up = (*q != '0');
+                    for (size_t k = 4; !up && k < parts.m_count; ++k)
+                        up = (parts.m_limbs[k] != 0);
                 }
-                else if (s_intdiv_type == Number::RATIONAL)
+                if (up)
+                    ++m;    // 10^19 still fits
+
+                int e = static_cast<int>(order) - 18;
+                while (m % 10 == 0)
                 {
-                    r = rational_type(get_i(), num.get_i());
-                    assign(r);
+                    m /= 10;
+                    ++e;
+                }
+
+                static const double s_pow10[] =
+                {
+                    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+                    1e20, 1e21, 1e22
+                };
+                double d;
+                if (m <= s_exact_double && -22 <= e && e <= 22)
+                {
+                    // one rounding of exact operands, as strtod would round
+                    d = static_cast<double>(m);
+                    d = (e < 0 ? d / s_pow10[-e] : d * s_pow10[e]);
                 }
                 else
                 {
-                    assert(0);
+                    char buf[32];
+                    char *end = buf + sizeof(buf);
+                    char *s = end;
+                    *--s = '\0';
+                    unsigned ue = static_cast<unsigned>(e < 0 ? -e : e);
+                    do
+                    {
+                        *--s = static_cast<char>('0' + ue % 10);
+                        ue /= 10;
+                    } while (ue);
+                    if (e < 0)
+                        *--s = '-';
+                    *--s = 'e';
+                    do
+                    {
+                        *--s = static_cast<char>('0' + m % 10);
+                        m /= 10;
+                    } while (m);
+                    d = std::strtod(s, NULL);
                 }
-                break;
-
-            case Number::FLOATING:
-                f = to_f();
-                f /= num.get_f();
-                assign(f);
-                break;
-
-            case Number::RATIONAL:
-                r = to_r();
-                r /= num.get_r();
-                assign(r);
-                break;
-
-            default:
-                assert(0);
-                break;
+                return parts.m_neg ? -d : d;
             }
-            break;
+        }
+#endif  // BOOST_VERSION >= 106000
+        return f.convert_to<double>();
+    }
 
-        case Number::FLOATING:
-            switch (num.type())
+    static __int64 f_to_int64(const floating_type& f, size_t& overflows)
+    {
+#if BOOST_VERSION >= 106000
+        DecFloatParts parts;
+        DecFloatSaver saver(parts);
+        const_cast<floating_type&>(f).backend().serialize(saver, 0);
+        if (parts.m_class == 0)
+        {
+            // the exponent is a multiple of 8, so each limb is either
+            // whole or fraction
+            if (parts.m_count == 0 || parts.m_exp < 0)
+                return 0;
+            unsigned long long mag = ~0ULL;
+            if (parts.m_exp < 16 || (parts.m_exp == 16 && parts.m_limbs[0] < 1000))
             {
-            case Number::INTEGER:
-                f = get_f();
-                f /= num.to_f();
-                assign(f);
-                break;
+                mag = 0;
+                for (size_t k = 0; 8 * static_cast<__int64>(k) <= parts.m_exp; ++k)
+                    mag = mag * s_limb10 + (k < parts.m_count ? parts.m_limbs[k] : 0);
+            }
+            return clamp_int64(parts.m_neg, mag, overflows);
+        }
+#endif  // BOOST_VERSION >= 106000
+        if (b_mp::isnan(f))
+        {
+            ++overflows;
+            return 0;
+        }
+        floating_type t = b_mp::trunc(f);
+        if (t >= static_cast<double>(s_int64_limit))
+            return clamp_int64(false, s_int64_limit, overflows);
+        if (t < -static_cast<double>(s_int64_limit))
+            return clamp_int64(true, ~0ULL, overflows);
+        return t.convert_to<__int64>();
+    }
 
-            case Number::FLOATING:
-                f = get_f();
-                f /= num.get_f();
-                assign(f);
-                break;
+    static double r_to_double(const rational_type& r)
+    {
+        unsigned long long num = 0, den = 1;
+        if (i_to_u64(b_mp::numerator(r), num) && num <= s_exact_double &&
+            i_to_u64(b_mp::denominator(r), den) && den <= s_exact_double)
+        {
+            // one rounding of exact operands
+            double d = static_cast<double>(num) / static_cast<double>(den);
+            return r.sign() < 0 ? -d : d;
+        }
+        return r.convert_to<double>();
+    }
 
-            case Number::RATIONAL:
-                f = get_f();
-                f /= num.to_f();
-                assign(f);
-                break;
+    static __int64 r_to_int64(const rational_type& r, size_t& overflows)
+    {
+        unsigned long long num = 0, den = 1;
+        if (i_to_u64(b_mp::numerator(r), num) &&
+            i_to_u64(b_mp::denominator(r), den))
+        {
+            return clamp_int64(r.sign() < 0, num / den, overflows);
+        }
+        integer_type q = b_mp::numerator(r) / b_mp::denominator(r);
+        return i_to_int64(q, overflows);
+    }
 
-            default:
-                assert(0);
-                break;
+    static double to_double(const Number& num)
+    {
+        switch (num.type())
+        {
+        case Number::INTEGER:
+            {
+                const integer_type& i = num.get_i();
+                unsigned long long mag;
+                if (i_to_u64(i, mag) && mag <= s_exact_double)
+                {
+                    double d = static_cast<double>(mag);
+                    return i.sign() < 0 ? -d : d;
+                }
+                return i.convert_to<double>();
             }
-            break;
+
+        case Number::FLOATING:
+            return f_to_double(num.get_f());
 
         case Number::RATIONAL:
-            switch (num.type())
-            {
-            case Number::INTEGER:
-                r = get_r();
-                r /= num.to_r();
-                assign(r);
-                break;
+            return r_to_double(num.get_r());
 
-            case Number::FLOATING:
-                f = to_f();
-                f /= num.get_f();
-                assign(f);
-                break;
+        default:
+            throw std::domain_error("pmp::to_doubles: nested vector");
+        }
+    }
 
-            case Number::RATIONAL:
-                r = get_r();
-                r /= num.get_r();
-                assign(r);
-                break;
+    static __int64 to_int64(const Number& num, size_t& overflows)
+    {
+        switch (num.type())
+        {
+        case Number::INTEGER:
+            return i_to_int64(num.get_i(), overflows);
 
-            default:
-                assert(0);
-                break;
-            }
-            break;
+        case Number::FLOATING:
+            return f_to_int64(num.get_f(), overflows);
+
+        case Number::RATIONAL:
+            return r_to_int64(num.get_r(), overflows);
 
         default:
-            assert(0);
-            break;
+            throw std::domain_error("pmp::to_int64s: nested vector");
         }
-        return *this;
     }
 
-    Number& Number::operator%=(const Number& num)
+    size_t to_doubles(const Number& num, double *out, size_t n)
     {
 #ifndef PMP_DISABLE_VECTOR
-        if (is_v() || num.is_v())
+        if (num.is_v())
         {
-            vector_type vec;
-            for (size_t i = 0; i < size(); ++i)
-            {
-                for (size_t j = 0; j < num.size(); ++j)
-                {
-                    Number tmp((*this)[i]);
-                    tmp %= num[j];
-                    vec.push_back(tmp);
-                }
-            }
-            assign(vec);
-            return *this;
+            const vector_type& vec = num.get_v();
+            if (n > vec.size())
+                n = vec.size();
+            for (size_t k = 0; k < n; ++k)
+                out[k] = to_double(vec[k]);
+            return n;
         }
 #endif
-        integer_type    i;
-        floating_type   f;
-        rational_type   r;
-        switch (type())
-        {
-        case Number::INTEGER:
-            switch (num.type())
-            {
-            case Number::INTEGER:
-                i = get_i();
-                i %= num.get_i();
-                assign(i);
-                break;
-
-            case Number::FLOATING:
-                f = to_f();
-                f = b_mp::fmod(f, num.get_f());
-                assign(f);
-                break;
-
-            default:
-                assert(0);
-                break;
-            }
-            break;
-
-        case Number::FLOATING:
-            switch (num.type())
-            {
-            case Number::INTEGER:
-                f = get_f();
-                f = b_mp::fmod(f, static_cast<floating_type>(num.get_i()));
-                assign(f);
-                break;
+        if (n == 0)
+            return 0;
+        out[0] = to_double(num);
+        return 1;
+    }
 
-            case Number::FLOATING:
-                f = get_f();
-                f = b_mp::fmod(f, num.get_f());
-                assign(f);
-                break;
+    size_t to_int64s(const Number& num, __int64 *out, size_t n,
+                     size_t *overflows/* = NULL*/)
+    {
+        size_t count = 0;
+#ifndef PMP_DISABLE_VECTOR
+        if (num.is_v())
+        {
+            const vector_type& vec = num.get_v();
+            if (n > vec.size())
+                n = vec.size();
+            for (size_t k = 0; k < n; ++k)
+                out[k] = to_int64(vec[k], count);
+        }
+        else
+#endif
+        {
+            if (n > 1)
+                n = 1;
+            if (n)
+                out[0] = to_int64(num, count);
+        }
+        if (overflows)
+            *overflows = count;
+        return n;
+    }
 
-            default:
-                assert(0);
-                break;
-            }
-            break;
+#ifndef PMP_DISABLE_VECTOR
+    // Number(double) gathers the bits of d into an integer M, 30 at a
+    // time with a multiply by 2^30 between steps, and then multiplies by
+    // 2^e for |d| = M * 2^e.  Making M at once and taking as many steps
+    // for e gives the same floating with one multiply instead of three.
+    // The backend makes 2^e beyond 2^127 by a division each time, so the
+    // batch keeps those in pow2s.
+    typedef std::unordered_map<int, floating_type::backend_type> pow2_map;
+
+    static void double_to_f(floating_type& f, double d, pow2_map& pow2s)
+    {
+        int e;
+        double frac = std::frexp(std::fabs(d), &e);
+        double m = std::ldexp(frac, 30);
+        if (m != std::floor(m))
+        {
+            m = std::ldexp(frac, 60);
+            e -= 30;
+        }
+        e -= 30;
+        f.backend() = static_cast<unsigned long long>(m);
+        if (-128 < e && e < 128)
+        {
+            f.backend() *= floating_type::backend_type::pow2(e);
+        }
+        else
+        {
+            pow2_map::iterator it = pow2s.find(e);
+            if (it == pow2s.end())
+                it = pow2s.insert(std::make_pair(e, floating_type::backend_type::pow2(e))).first;
+            f.backend() *= it->second;
+        }
+        if (d < 0)
+            f.backend().negate();
+    }
 
-        default:
-            assert(0);
-            break;
+    Number from_doubles(const double *values, size_t n)
+    {
+        vector_type empty;
+        Number result(empty);
+        vector_type& vec = result.get_v();
+        vec.reserve(n);
+        floating_type f;
+        pow2_map pow2s;
+        for (size_t k = 0; k < n; ++k)
+        {
+            double d = values[k];
+            if (d == 0 || d == 1 || !(std::isfinite)(d))
+            {
+                vec.push_back(Number(d));   // shared or special
+                continue;
+            }
+            double_to_f(f, d, pow2s);
+            vec.push_back(Number(f));
         }
-        return *this;
+        return result;
+    }
+
+    Number from_int64s(const __int64 *values, size_t n)
+    {
+        vector_type empty;
+        Number result(empty);
+        vector_type& vec = result.get_v();
+        vec.reserve(n);
+        for (size_t k = 0; k < n; ++k)
+            vec.push_back(Number(values[k]));
+        return result;
     }
+#endif  // ndef PMP_DISABLE_VECTOR
 
     bool Number::is_zero() const
     {
@@ -617,6 +4404,8 @@ namespace pmp
             return get_f().is_zero();
 
         case Number::RATIONAL:
+            if (is_lazy())
+                return m_inner->lazy().num.is_zero();
             return get_r().is_zero();
 
 #ifndef PMP_DISABLE_VECTOR
@@ -640,7 +4429,7 @@ namespace pmp
         switch (type())
         {
         case Number::INTEGER:
-            return get_i().str();
+            return i_to_str(get_i());
 
         case Number::FLOATING:
             return get_f().str();
@@ -718,6 +4507,8 @@ namespace pmp
             return get_f().sign();;
 
         case Number::RATIONAL:
+            if (is_lazy())
+                return m_inner->lazy().num.sign();
             return get_r().sign();
 
         default:
@@ -844,6 +4635,23 @@ namespace pmp
         }
     }
 
+    lazy_rational Number::to_lazy() const
+    {
+        switch (type())
+        {
+        case Number::INTEGER:
+            return lazy_rational(get_i(), integer_type(1));
+
+        case Number::RATIONAL:
+            if (is_lazy())
+                return m_inner->lazy();
+            return lazy_rational(get_r());
+
+        default:
+            return lazy_rational(to_r());
+        }
+    }
+
 #ifndef PMP_DISABLE_VECTOR
     vector_type Number::to_v() const
     {
@@ -901,6 +4709,135 @@ namespace pmp
         }
     }
 
+    // compares at the precision of floating_type
+    static int compare_rounded(const Number& num1, const Number& num2)
+    {
+        floating_type f;
+        switch (num1.type())
+        {
+        case Number::INTEGER:
+            switch (num2.type())
+            {
+            case Number::INTEGER:
+                return num1.get_i().compare(num2.get_i());
+
+            case Number::FLOATING:
+                f = num1.to_f();
+                return f.compare(num2.get_f());
+
+            case Number::RATIONAL:
+                f = num1.to_f();
+                return f.compare(num2.to_f());
+
+            default:
+                assert(0);
+                return 0;
+            }
+
+        case Number::FLOATING:
+            switch (num2.type())
+            {
+            case Number::INTEGER:
+                f = num2.to_f();
+                return num1.get_f().compare(f);
+
+            case Number::FLOATING:
+                return num1.get_f().compare(num2.get_f());
+
+            case Number::RATIONAL:
+                return num1.get_f().compare(num2.to_f());
+
+            default:
+                assert(0);
+                return 0;
+            }
+
+        case Number::RATIONAL:
+            switch (num2.type())
+            {
+            case Number::INTEGER:
+                f = num2.to_f();
+                return num1.to_f().compare(f);
+
+            case Number::FLOATING:
+                return num1.to_f().compare(num2.get_f());
+
+            case Number::RATIONAL:
+                return num1.to_f().compare(num2.to_f());
+
+            default:
+                assert(0);
+                return 0;
+            }
+
+        default:
+            assert(0);
+            return 0;
+        }
+    }
+
+    // f = n * 10^e exactly; f is finite
+    static void f_to_decimal(const floating_type& f, integer_type& n, long& e)
+    {
+#if BOOST_VERSION >= 106000
+        DecFloatParts parts;
+        DecFloatSaver saver(parts);
+        const_cast<floating_type&>(f).backend().serialize(saver, 0);
+        size_t count = parts.m_count;
+        while (count > 0 && parts.m_limbs[count - 1] == 0)
+            --count;
+        n = 0;
+        for (size_t k = 0; k < count; ++k)
+        {
+            n *= s_limb10;
+            n += parts.m_limbs[k];
+        }
+        if (parts.m_neg)
+            n = -n;
+        e = count ? static_cast<long>(parts.m_exp) - 8 * static_cast<long>(count - 1) : 0;
+#else
+        std::string str = f.str(0, std::ios_base::scientific);
+        size_t pos = str.find('e');
+        std::string digits;
+        for (size_t i = 0; i < pos; ++i)
+        {
+            if (std::isdigit(static_cast<unsigned char>(str[i])))
+                digits += str[i];
+        }
+        n = integer_type(digits);
+        if (str[0] == '-')
+            n = -n;
+        e = std::atol(str.c_str() + pos + 1) - static_cast<long>(digits.size() - 1);
+#endif
+    }
+
+    // num1 and num2 are finite and not both integers or both floatings
+    static int compare_exact(const Number& num1, const Number& num2)
+    {
+        if (!num1.is_f() && !num2.is_f())
+        {
+            int comp = num1.to_r().compare(num2.to_r());
+            return comp < 0 ? -1 : (comp > 0 ? 1 : 0);
+        }
+
+        if (num2.is_f())
+            return -compare_exact(num2, num1);
+
+        // num1 = n * 10^e against num2 = p / q
+        integer_type n, p, q;
+        long e;
+        f_to_decimal(num1.get_f(), n, e);
+        rational_type r = num2.to_r();
+        p = b_mp::numerator(r);
+        q = b_mp::denominator(r);
+        n *= q;
+        if (e >= 0)
+            n *= pow10(static_cast<size_t>(e));
+        else
+            p *= pow10(static_cast<size_t>(-e));
+        return n < p ? -1 : (n == p ? 0 : 1);
+    }
+
     int Number::compare(const Number& num) const
     {
 #ifndef PMP_DISABLE_VECTOR
@@ -915,68 +4852,514 @@ namespace pmp
         }
 #endif
 
-        floating_type f;
+        // a tie at the precision of floating_type is settled exactly, so
+        // that numbers which compare equal also hash alike
+        int comp = compare_rounded(*this, num);
+        if (comp == 0 && !(is_i() && num.is_i()) && !(is_f() && num.is_f()) &&
+            !(is_f() && !b_mp::isfinite(get_f())) &&
+            !(num.is_f() && !b_mp::isfinite(num.get_f())))
+        {
+            comp = compare_exact(*this, num);
+        }
+        return comp;
+    }
+
+    //
+    // hashing
+    //
+    // A number hashes as its value modulo the Mersenne prime 2^61 - 1,
+    // with n/d taken as n * d^-1.  The residue depends only on the value,
+    // so integers, rationals and decimal floats that are equal agree.
+    //
+    typedef boost::uint64_t hash_type;
+    static const hash_type s_hash_prime = (hash_type(1) << 61) - 1;
+    static const hash_type s_hash_inf = 314159;     // also d = 0 mod p
+    static const hash_type s_hash_nan = 271828;
+
+    // values whose hash is cached in Inner
+    static const size_t s_hash_cache_limbs = 4;
+
+    static inline hash_type hash_fold(hash_type x)
+    {
+        x = (x & s_hash_prime) + (x >> 61);
+        return x >= s_hash_prime ? x - s_hash_prime : x;
+    }
+
+    // a * b mod p for a, b < p, in 32-bit halves so it needs no 128-bit type
+    static hash_type hash_mul(hash_type a, hash_type b)
+    {
+        hash_type a_lo = a & 0xFFFFFFFF, a_hi = a >> 32;
+        hash_type b_lo = b & 0xFFFFFFFF, b_hi = b >> 32;
+        hash_type lo = a_lo * b_lo;
+        hash_type mid = a_lo * b_hi + a_hi * b_lo;
+        hash_type hi = a_hi * b_hi;
+
+        // 2^64 = 8 and 2^61 = 1 (mod p)
+        hash_type x = (lo & s_hash_prime) + (lo >> 61) + (hi << 3) +
+                      ((mid & ((hash_type(1) << 29) - 1)) << 32) + (mid >> 29);
+        return hash_fold(x);
+    }
+
+    static hash_type hash_pow(hash_type base, hash_type e)
+    {
+        hash_type result = 1;
+        for (; e; e >>= 1)
+        {
+            if (e & 1)
+                result = hash_mul(result, base);
+            base = hash_mul(base, base);
+        }
+        return result;
+    }
+
+    // 10^e mod p for any e
+    static hash_type hash_pow10(long e)
+    {
+        static const hash_type s_inv10 = 2075258708292324556ULL;    // 1/10 mod p
+        if (e >= 0)
+            return hash_pow(10, static_cast<hash_type>(e));
+        return hash_pow(s_inv10, static_cast<hash_type>(-e));
+    }
+
+    // 2^limb_bits mod p
+    static const hash_type s_hash_radix =
+        hash_type(1) << (s_limb_bits > 61 ? s_limb_bits - 61 : s_limb_bits);
+
+    static hash_type hash_integer(const integer_type& i)
+    {
+        if (i.is_zero())
+            return 0;
+
+        size_t n = i.backend().size();
+        const limb_type *limbs = i.backend().limbs();
+        hash_type h = 0;
+        for (size_t k = n; k-- > 0; )
+        {
+            h = hash_mul(h, s_hash_radix);
+            h = hash_fold(h + hash_fold(limbs[k]));
+        }
+        return (i.sign() < 0 && h) ? s_hash_prime - h : h;
+    }
+
+    static hash_type hash_rational(const integer_type& num, const integer_type& den)
+    {
+        hash_type d = hash_integer(den);
+        if (d == 0)
+            return num.sign() < 0 ? s_hash_prime - s_hash_inf : s_hash_inf;
+        return hash_mul(hash_integer(num), hash_pow(d, s_hash_prime - 2));
+    }
+
+    static hash_type hash_floating(const floating_type& f)
+    {
+        if (b_mp::isnan(f))
+            return s_hash_nan;
+        if (b_mp::isinf(f))
+            return f.sign() < 0 ? s_hash_prime - s_hash_inf : s_hash_inf;
+
+        // Peel off chunks of at most 16 digits, scaling only by powers of
+        // 10^8 so that every step is exact on cpp_dec_float's base-10^8
+        // limbs.  Invariant: |f| = (hashed so far) + v * 10^offset.
+        const floating_type limb_radix(100000000);
+        floating_type v = b_mp::abs(f), scale(1), chunk;
+        long offset = 0, scale_exp10 = 0, last_exp10 = 0;
+        hash_type h = 0;
+        while (!v.is_zero())
+        {
+            // the smallest multiple of 8 that is >= order - 15
+            long t = static_cast<long>(v.backend().order()) - 15;
+            long s = (t >= 0) ? (t + 7) / 8 * 8 : -(-t / 8 * 8);
+            if (std::abs(s) != scale_exp10)
+            {
+                scale_exp10 = std::abs(s);
+                scale = b_mp::pow(limb_radix, static_cast<int>(scale_exp10 / 8));
+            }
+            long chunk_exp10;
+            if (s <= 0)
+            {
+                v *= scale;
+                offset += s;
+                chunk = b_mp::trunc(v);
+                v -= chunk;
+                chunk_exp10 = offset;
+            }
+            else
+            {
+                chunk = b_mp::trunc(v / scale);
+                floating_type rest = v - chunk * scale;
+                while (rest.sign() < 0)
+                {
+                    chunk -= 1;
+                    rest += scale;
+                }
+                while (rest >= scale)
+                {
+                    chunk += 1;
+                    rest -= scale;
+                }
+                v = rest;
+                chunk_exp10 = offset + s;
+            }
+            // the exponents only go down: h = h * 10^(last - this) + chunk
+            hash_type c = hash_fold(chunk.convert_to<unsigned long long>());
+            if (h)
+                h = hash_mul(h, hash_pow10(last_exp10 - chunk_exp10));
+            h = hash_fold(h + c);
+            last_exp10 = chunk_exp10;
+        }
+        h = hash_mul(h, hash_pow10(last_exp10));
+        return (f.sign() < 0 && h) ? s_hash_prime - h : h;
+    }
+
+    size_t Number::hash() const
+    {
+        size_t cached = m_inner->m_hash.load(std::memory_order_relaxed);
+        if (cached)
+            return cached;
+
+        hash_type h;
+        bool cache = true;
         switch (type())
         {
         case Number::INTEGER:
-            switch (num.type())
+            h = hash_integer(get_i());
+            cache = get_i().backend().size() > s_hash_cache_limbs;
+            break;
+
+        case Number::FLOATING:
+            h = hash_floating(get_f());
+            break;
+
+        case Number::RATIONAL:
+            if (is_lazy() && hash_integer(m_inner->lazy().den) != 0)
             {
-            case Number::INTEGER:
-                return get_i().compare(num.get_i());
+                // n/d and its reduced form have the same residue
+                h = hash_rational(m_inner->lazy().num, m_inner->lazy().den);
+            }
+            else
+            {
+                h = hash_rational(b_mp::numerator(get_r()), b_mp::denominator(get_r()));
+            }
+            break;
 
-            case Number::FLOATING:
-                f = to_f();
-                return f.compare(num.get_f());
+#ifndef PMP_DISABLE_VECTOR
+        case Number::VECTOR:
+            // elements cache their own hashes; a vector can change
+            // through them, so it is not cached itself
+            h = 0x3141592653ULL;
+            for (size_t i = 0; i < get_v().size(); ++i)
+                h = hash_fold(hash_mul(h, 1000003) + hash_fold(get_v()[i].hash()));
+            cache = false;
+            break;
+#endif
 
-            case Number::RATIONAL:
-                f = to_f();
-                return f.compare(num.to_f());
+        default:
+            assert(0);
+            h = 0;
+            break;
+        }
 
-            default:
-                assert(0);
-                return 0;
-            }
+        size_t result = static_cast<size_t>(h ^ (h >> 32));
+        if (result == 0)
+            result = 1;     // 0 marks "not computed"
+        if (cache)
+            m_inner->m_hash.store(result, std::memory_order_relaxed);
+        return result;
+    }
+
+    //
+    // memoization
+    //
+    // Keys and results are clone()s: Number shares its Inner on copy and
+    // the non-const accessors write through it, so a shallow copy in the
+    // cache could change under it.  They are made outside any arena.
+    // floating_type has a fixed precision, so the argument types and
+    // values determine the result.
+    //
+    static const size_t s_memo_shards = 16;
+
+    static std::atomic<bool> s_memoize(false);
+    static std::atomic<size_t> s_memo_capacity(4096);
+    static std::atomic<size_t> s_memo_hits(0);
+    static std::atomic<size_t> s_memo_misses(0);
+
+    static inline bool memo_scalar(const Number& num)
+    {
+        return num.is_i() || num.is_f() || num.is_r();
+    }
 
+    static bool memo_same(const Number& num1, const Number& num2)
+    {
+        if (num1.type() != num2.type())
+            return false;
+        switch (num1.type())
+        {
+        case Number::INTEGER:
+            return num1.get_i() == num2.get_i();
         case Number::FLOATING:
-            switch (num.type())
+            return num1.get_f() == num2.get_f();
+        case Number::RATIONAL:
+            return num1.get_r() == num2.get_r();
+        default:
+            return false;
+        }
+    }
+
+    struct MemoKey
+    {
+        MemoFunction    m_fn;
+        bool            m_binary;
+        Number          m_num1;
+        Number          m_num2;
+        size_t          m_hash;
+
+        bool operator==(const MemoKey& key) const
+        {
+            return m_hash == key.m_hash && m_fn == key.m_fn &&
+                   m_binary == key.m_binary &&
+                   memo_same(m_num1, key.m_num1) &&
+                   (!m_binary || memo_same(m_num2, key.m_num2));
+        }
+    };
+
+    struct MemoKeyHash
+    {
+        size_t operator()(const MemoKey& key) const
+        {
+            return key.m_hash;
+        }
+    };
+
+    // one lock per shard; the list holds the entries from the most to the
+    // least recently used and the map points into it
+    struct MemoShard
+    {
+        typedef std::pair<MemoKey, Number>              entry_type;
+        typedef std::list<entry_type>                   list_type;
+        typedef std::unordered_map<MemoKey, list_type::iterator,
+                                   MemoKeyHash>         map_type;
+
+        std::mutex  m_mutex;
+        list_type   m_list;
+        map_type    m_map;
+    };
+
+    static MemoShard s_memo[s_memo_shards];
+
+    static bool memo_key(MemoKey& key, MemoFunction fn, const Number& num1,
+                         const Number *num2)
+    {
+        if (!memo_scalar(num1) || (num2 && !memo_scalar(*num2)))
+            return false;
+
+        key.m_fn = fn;
+        key.m_binary = (num2 != NULL);
+        size_t h = num1.hash() * 31 + static_cast<size_t>(fn) + 1;
+        if (num2)
+            h = h * 1000003 + num2->hash();
+        h ^= static_cast<size_t>(num1.type()) << 8;
+        if (num2)
+            h ^= static_cast<size_t>(num2->type()) << 12;
+        key.m_hash = h;
+        return true;
+    }
+
+    static inline MemoShard& memo_shard(const MemoKey& key)
+    {
+        return s_memo[(key.m_hash ^ (key.m_hash >> 17)) % s_memo_shards];
+    }
+
+    static void memo_evict(MemoShard& shard, size_t limit)
+    {
+        while (shard.m_list.size() > limit)
+        {
+            shard.m_map.erase(shard.m_list.back().first);
+            shard.m_list.pop_back();
+        }
+    }
+
+    bool SetMemoize(bool enable)
+    {
+        return s_memoize.exchange(enable);
+    }
+
+    size_t SetMemoizeCapacity(size_t entries)
+    {
+        size_t old_entries = s_memo_capacity.exchange(entries);
+        size_t limit = (entries + s_memo_shards - 1) / s_memo_shards;
+        for (size_t i = 0; i < s_memo_shards; ++i)
+        {
+            std::lock_guard<std::mutex> lock(s_memo[i].m_mutex);
+            memo_evict(s_memo[i], limit);
+        }
+        return old_entries;
+    }
+
+    MemoStats GetMemoStats()
+    {
+        MemoStats stats;
+        stats.hits = s_memo_hits.load();
+        stats.misses = s_memo_misses.load();
+        stats.size = 0;
+        for (size_t i = 0; i < s_memo_shards; ++i)
+        {
+            std::lock_guard<std::mutex> lock(s_memo[i].m_mutex);
+            stats.size += s_memo[i].m_list.size();
+        }
+        return stats;
+    }
+
+    void ClearMemo()
+    {
+        for (size_t i = 0; i < s_memo_shards; ++i)
+        {
+            std::lock_guard<std::mutex> lock(s_memo[i].m_mutex);
+            s_memo[i].m_map.clear();
+            s_memo[i].m_list.clear();
+        }
+        s_memo_hits = 0;
+        s_memo_misses = 0;
+    }
+
+    bool memo_lookup(MemoFunction fn, const Number& num1, const Number *num2,
+                     Number& result)
+    {
+        if (!s_memoize.load(std::memory_order_relaxed))
+            return false;
+
+        MemoKey key;
+        if (!memo_key(key, fn, num1, num2))
+            return false;
+        key.m_num1 = num1;
+        if (num2)
+            key.m_num2 = *num2;
+
+        MemoShard& shard = memo_shard(key);
+        {
+            std::lock_guard<std::mutex> lock(shard.m_mutex);
+            MemoShard::map_type::iterator it = shard.m_map.find(key);
+            if (it != shard.m_map.end())
             {
-            case Number::INTEGER:
-                f = num.to_f();
-                return get_f().compare(f);
+                shard.m_list.splice(shard.m_list.begin(), shard.m_list, it->second);
+                result = it->second->second.clone();
+                ++s_memo_hits;
+                return true;
+            }
+        }
+        ++s_memo_misses;
+        return false;
+    }
 
-            case Number::FLOATING:
-                return get_f().compare(num.get_f());
+    const Number& memo_store(MemoFunction fn, const Number& num1,
+                             const Number *num2, const Number& result)
+    {
+        if (!s_memoize.load(std::memory_order_relaxed) || !memo_scalar(result))
+            return result;
+
+        MemoKey key;
+        if (!memo_key(key, fn, num1, num2))
+            return result;
+        size_t limit = (s_memo_capacity.load(std::memory_order_relaxed) +
+                        s_memo_shards - 1) / s_memo_shards;
+        if (limit == 0)
+            return result;
+        key.m_num1 = num1;
+        if (num2)
+            key.m_num2 = *num2;
+
+        MemoShard& shard = memo_shard(key);
+        std::lock_guard<std::mutex> lock(shard.m_mutex);
+        if (shard.m_map.find(key) != shard.m_map.end())
+            return result;      // another thread got here first
+
+        // the cache's own copies are made, counted and dropped under the
+        // lock, which PMP_SINGLE_THREADED reference counts rely on
+        Arena::Suspend suspend;
+        shard.m_list.push_front(MemoShard::entry_type());
+        MemoShard::entry_type& entry = shard.m_list.front();
+        entry.first.m_fn = key.m_fn;
+        entry.first.m_binary = key.m_binary;
+        entry.first.m_hash = key.m_hash;
+        entry.first.m_num1 = num1.clone();
+        if (num2)
+            entry.first.m_num2 = num2->clone();
+        entry.second = result.clone();
+        shard.m_map[entry.first] = shard.m_list.begin();
+        memo_evict(shard, limit);
+        return result;
+    }
 
-            case Number::RATIONAL:
-                return get_f().compare(num.to_f());
+    Number Number::clone() const
+    {
+        switch (type())
+        {
+        case Number::INTEGER:
+            return Number(get_i());
 
-            default:
-                assert(0);
-                return 0;
-            }
+        case Number::FLOATING:
+            return Number(get_f());
 
         case Number::RATIONAL:
-            switch (num.type())
+            if (is_lazy())
             {
-            case Number::INTEGER:
-                f = num.to_f();
-                return to_f().compare(f);
-
-            case Number::FLOATING:
-                return to_f().compare(num.get_f());
-
-            case Number::RATIONAL:
-                return to_f().compare(num.to_f());
+                Number num;
+                num.m_inner = new_inner(*m_inner);
+                return num;
+            }
+            return Number(get_r());
 
-            default:
-                assert(0);
-                return 0;
+#ifndef PMP_DISABLE_VECTOR
+        case Number::VECTOR:
+            {
+                vector_type vec;
+                vec.reserve(size());
+                for (size_t i = 0; i < size(); ++i)
+                    vec.push_back(get_v()[i].clone());
+                return Number(vec);
             }
+#endif
 
         default:
             assert(0);
-            return 0;
+            return *this;
+        }
+    }
+
+    // rounds f to precision digits after the point, half to even, like
+    // str(precision, std::ios_base::fixed) does
+    static floating_type f_round(const floating_type& f, unsigned precision)
+    {
+        typedef floating_type::backend_type backend_type;
+        static const long s_window = backend_type::cpp_dec_float_total_digits10;
+
+        if (precision == 0 || f.backend().isint() ||
+            f.backend().order() + 1 + static_cast<long>(precision) >= s_window)
+        {
+            return f;   // no digit beyond the rounding position
+        }
+
+        floating_type i = b_mp::trunc(f);
+        floating_type r = f - i;
+        if (r.backend().order() + 1 + static_cast<long>(precision) + 8 >= s_window)
+        {
+            // the scaled fraction could lose its first digit
+            return floating_type(f.str(precision, std::ios_base::fixed));
+        }
+
+        r *= floating_type(backend_type(1.0, static_cast<int>(precision)));
+        floating_type n = b_mp::trunc(r);
+        floating_type d = b_mp::abs(r - n);
+        int cmp = d.compare(0.5);
+        if (cmp == 0)
+        {
+            floating_type h = n;
+            h.backend().div_unsigned_long_long(2);
+            if (!h.backend().isint())
+                cmp = 1;
         }
+        if (cmp > 0)
+            n += r.sign();
+        n *= floating_type(backend_type(1.0, -static_cast<int>(precision)));
+        return i + n;
     }
 
     void Number::trim(unsigned precision/* = s_default_precision*/)
@@ -988,12 +5371,11 @@ namespace pmp
 
         case Number::FLOATING:
             {
-                assign(str(precision, std::ios_base::fixed));
-
-                integer_type i = to_i();
-                floating_type f = static_cast<floating_type>(i);
-                if (f == get_f())
-                    assign(i);
+                floating_type f = f_round(get_f(), precision);
+                if (f.backend().isint())
+                    assign(pmp::f_to_i(f));
+                else if (f != get_f())
+                    assign(f);
             }
             break;
 
@@ -1020,13 +5402,120 @@ namespace pmp
         }
     }
 
+    void Number::demote()
+    {
+        switch (type())
+        {
+        case Number::FLOATING:
+            {
+                const floating_type& f = get_f();
+                if (f.backend().isint() &&
+                    f.backend().order() < std::numeric_limits<floating_type>::digits10)
+                {
+                    assign(pmp::f_to_i(f));
+                }
+            }
+            break;
+
+        case Number::RATIONAL:
+            if (is_lazy())
+            {
+                // whole when den divides the unreduced num
+                const lazy_rational& q = m_inner->lazy();
+                if (q.den == 1)
+                {
+                    assign(q.num);
+                }
+                else
+                {
+                    integer_type i, rem;
+                    b_mp::divide_qr(q.num, q.den, i, rem);
+                    if (rem.is_zero())
+                        assign(i);
+                }
+            }
+            else if (b_mp::denominator(get_r()) == 1)
+            {
+                assign(b_mp::numerator(get_r()));
+            }
+            break;
+
+#ifndef PMP_DISABLE_VECTOR
+        case Number::VECTOR:
+            for (size_t i = 0; i < get_v().size(); ++i)
+                get_v()[i].demote();
+            break;
+#endif
+
+        default:
+            break;
+        }
+    }
+
+    void Number::normalize()
+    {
+        switch (type())
+        {
+        case Number::RATIONAL:
+            if (is_lazy())
+                assign(get_r());
+            break;
+
+#ifndef PMP_DISABLE_VECTOR
+        case Number::VECTOR:
+            for (size_t i = 0; i < get_v().size(); ++i)
+                get_v()[i].normalize();
+            break;
+#endif
+
+        default:
+            break;
+        }
+    }
+
+    // The integer part is read off the decimal digits 16 at a time (two
+    // limbs of the backend, so every scaling by ten is exact) instead of
+    // formatting and parsing the whole number.
     /*static*/ integer_type f_to_i(const floating_type& f)
     {
-        std::string str = f.str(0, std::ios_base::fixed);
-        size_t i = str.find('.');
-        if (i != std::string::npos)
-            str = str.substr(0, i);
-        return integer_type(str);
+        typedef floating_type::backend_type backend_type;
+        static const unsigned long long s_chunk = 10000000000000000ULL;
+
+        if (!b_mp::isfinite(f))
+        {
+            std::string str = f.str(0, std::ios_base::fixed);
+            size_t i = str.find('.');
+            if (i != std::string::npos)
+                str = str.substr(0, i);
+            return integer_type(str);
+        }
+
+        floating_type g = b_mp::trunc(f);
+        bool neg = g.sign() < 0;
+        if (neg)
+            g = -g;
+        if (g < s_chunk)
+        {
+            integer_type i(g.backend().extract_unsigned_long_long());
+            return neg ? integer_type(-i) : i;
+        }
+
+        int chunks = static_cast<int>(g.backend().order() / 16);
+        g *= floating_type(backend_type(1.0, -16 * chunks));
+        integer_type i;
+        for (; chunks >= 0; --chunks)
+        {
+            floating_type c = b_mp::trunc(g);
+            i *= s_chunk;
+            i += c.backend().extract_unsigned_long_long();
+            g -= c;
+            if (g.is_zero())
+                break;
+            g.backend().mul_unsigned_long_long(s_chunk);
+        }
+        if (chunks > 0)
+            i *= b_mp::pow(integer_type(s_chunk), chunks);
+        return neg ? integer_type(-i) : i;
     }
 
     /*static*/ rational_type f_to_r(const floating_type& f)
@@ -1036,7 +5525,7 @@ namespace pmp
         if (m.is_zero())
             return rational_type(n, integer_type(1));
 
-        integer_type k("620448401733239439360000"); // 24!
+        integer_type k = i_factorial(24);
         m *= floating_type(k);
         integer_type j = f_to_i(m + 0.5);
         j += n * k + 1;
@@ -1196,12 +5685,208 @@ namespace pmp
             return 0;
         }
     }
+
+    Summation::Summation() :
+        m_integer(0),
+        m_numerator(0),
+        m_denominator(1),
+        m_floating(0),
+        m_has_rational(false),
+        m_has_floating(false),
+        m_count(0)
+    {
+    }
+
+    void Summation::add(const Number& num)
+    {
+        switch (num.type())
+        {
+        case Number::INTEGER:
+            m_integer += num.get_i();
+            break;
+
+        case Number::FLOATING:
+            m_floating += num.get_f();
+            m_has_floating = true;
+            break;
+
+        case Number::RATIONAL:
+            {
+                lazy_rational q = num.to_lazy();
+                add_rational(q.num, q.den);
+                m_has_rational = true;
+            }
+            break;
+
+#ifndef PMP_DISABLE_VECTOR
+        case Number::VECTOR:
+            for (size_t i = 0; i < num.size(); ++i)
+                add(num.get_v()[i]);
+            return;
+#endif
+
+        default:
+            assert(0);
+            return;
+        }
+        ++m_count;
+    }
+
+    void Summation::add_rational(const integer_type& num,
+                                 const integer_type& denom)
+    {
+        if (denom == m_denominator)
+        {
+            m_numerator += num;
+            return;
+        }
+
+        // extend to the least common denominator
+        integer_type g = b_mp::gcd(m_denominator, denom);
+        integer_type scale = denom / g;
+        m_numerator *= scale;
+        m_numerator += num * (m_denominator / g);
+        m_denominator *= scale;
+    }
+
+    Number Summation::result() const
+    {
+        if (m_has_floating)
+        {
+            floating_type f = m_floating;
+            if (m_has_rational)
+                f += r_to_f(rational_type(m_numerator + m_integer * m_denominator,
+                                          m_denominator));
+            else
+                f += i_to_f(m_integer);
+            return Number(f);
+        }
+        if (m_has_rational)
+        {
+            return Number(m_numerator + m_integer * m_denominator,
+                          m_denominator);
+        }
+        return Number(m_integer);
+    }
+
+    Number Summation::average() const
+    {
+        floating_type f = result().to_f();
+        f /= floating_type(static_cast<unsigned long long>(m_count));
+        return Number(f);
+    }
+
+    // exact powers larger than this (in bits) are left to floating pow
+    static const size_t s_pow_exact_max_bits = size_t(1) << 24;
+
+    Number pow_exact(const Number& num1, const integer_type& e)
+    {
+        assert(num1.is_i() || num1.is_r());
+        integer_type num = num1.is_r() ? integer_type(b_mp::numerator(num1.get_r()))
+                                       : num1.get_i();
+        integer_type denom = num1.is_r() ? integer_type(b_mp::denominator(num1.get_r()))
+                                         : integer_type(1);
+
+        bool negative = e.sign() < 0;
+        if (negative && num.is_zero())
+        {
+            floating_type f = b_mp::pow(num1.to_f(), i_to_f(e));
+            return Number(f);
+        }
+
+        integer_type n = b_mp::abs(e);
+        if (n > std::numeric_limits<unsigned long>::max())
+        {
+            // only 0, 1 and -1 have a representable power
+            if (num1.is_i() && (num.is_zero() || b_mp::abs(num) == 1))
+            {
+                if (num.sign() < 0 && b_mp::bit_test(n, 0))
+                    return -1;
+                return num.is_zero() ? 0 : 1;
+            }
+            floating_type f = b_mp::pow(num1.to_f(), i_to_f(e));
+            return Number(f);
+        }
+
+        unsigned long u = n.convert_to<unsigned long>();
+        size_t bits = 0;
+        if (b_mp::abs(num) > 1)
+            bits = bit_length(num);
+        if (denom > 1)
+            bits = (std::max)(bits, bit_length(denom));
+        if (bits > 0 && u > s_pow_exact_max_bits / bits)
+        {
+            // too big to be worth an exact answer
+            floating_type f = b_mp::pow(num1.to_f(), i_to_f(e));
+            return Number(f);
+        }
+
+        integer_type pn, pd;
+        i_pow(pn, num, u);
+        if (denom != 1)
+            i_pow(pd, denom, u);
+        else
+            pd = 1;
+
+        if (negative)
+            return Number(pd, pn);
+        if (num1.is_i())
+            return Number(pn);
+        return Number(pn, pd);
+    }
+
+    // ranges shorter than this are not worth a thread
+    static const size_t s_parallel_product_min = 64;
+
+    Number product_tree(const vector_type& vec, size_t first, size_t last,
+                        unsigned num_threads/* = 1*/)
+    {
+        assert(first <= last && last <= vec.size());
+        size_t count = last - first;
+        switch (count)
+        {
+        case 0:
+            return 1;
+
+        case 1:
+            return vec[first];
+
+        case 2:
+            return vec[first] * vec[first + 1];
+
+        default:
+            break;
+        }
+
+        // split in the middle so that both operands grow at the same rate
+        size_t mid = first + count / 2;
+#ifdef PMP_SINGLE_THREADED
+        num_threads = 1;    // the reference counts are not atomic
+#endif
+        if (num_threads > 1 && count >= s_parallel_product_min)
+        {
+            unsigned left_threads = num_threads / 2;
+            std::future<Number> left =
+                std::async(std::launch::async,
+                           static_cast<Number (*)(const vector_type&, size_t,
+                                                  size_t, unsigned)>(product_tree),
+                           std::cref(vec), first, mid, left_threads);
+            Number right = product_tree(vec, mid, last, num_threads - left_threads);
+            return left.get() * right;
+        }
+        return product_tree(vec, first, mid, 1) * product_tree(vec, mid, last, 1);
+    }
 }
 
 /////////////////////////////////////////////////////////////////////////////
 // unit test and example
 
 #ifdef UNITTEST
+    #include <unordered_set>
+    #include <sstream>
+    #include <fstream>
+    #include <cstdio>
+
     using namespace pmp;
     int main(void)
     {
@@ -1423,6 +6108,605 @@ namespace pmp
         std::cout << n10.to_f() << std::endl;
         std::cout << pmp::r_to_f(n10.to_r()) << std::endl;
 
+        vector_type v1;
+        for (int i = 1; i <= 300; ++i)
+            v1.push_back(i);
+        Number n11 = pmp::prod(Number(v1));
+        Number n12 = 1;
+        for (int i = 1; i <= 300; ++i)
+            n12 *= i;
+        assert(n11.is_i());
+        assert(n11 == n12);
+        assert(pmp::product_tree(v1, 4) == n12);
+        assert(pmp::prod(Number(vector_type())) == 1);
+        vector_type v2;
+        v2.push_back(1);
+        v2.push_back(Number(1, 3));
+        v2.push_back(Number(1, 6));
+        assert(pmp::sum(Number(v2)).is_r());
+        assert(pmp::sum(Number(v2)) == Number(3, 2));
+        v2.push_back(0.5);
+        assert(pmp::sum(Number(v2)).is_f());
+        assert(pmp::sum(Number(v2)) == 2.0);
+        assert(pmp::average(Number(v2)) == 0.5);
+        bool lazy = SetLazyRational(true);
+        Number n13(1, 3);
+        for (int i = 0; i < 10; ++i)
+            n13 = n13 * Number(6, 5) + Number(1, 7);
+        assert(n13.is_lazy());
+        Number n14 = n13;
+        n14.normalize();
+        assert(!n14.is_lazy() && n14.is_r());
+        assert(n13 == n14);
+        assert(n13.str() == n14.str());
+        SetLazyRational(lazy);
+        Number n15(1, 3);
+        for (int i = 0; i < 10; ++i)
+            n15 = n15 * Number(6, 5) + Number(1, 7);
+        assert(n15.str() == n14.str());
+        integer_type i1 = b_mp::pow(integer_type(3), 30000);
+        integer_type i2 = b_mp::pow(integer_type(7), 20000) - 1;
+        MulThresholds thresholds = { 4, 12, 40 };
+        thresholds = SetMulThresholds(thresholds);
+        assert(i_mul(i1, i2) == i1 * i2);
+        assert(i_mul(-i1, i2) == -(i1 * i2));
+        assert(i_mul(i1, i1) == i1 * i1);
+        assert(Number(i1) * Number(i2) == Number(integer_type(i1 * i2)));
+        SetMulThresholds(thresholds);
+
+        size_t div_threshold = SetDivThreshold(4);
+        integer_type i3, i4;
+        i_divmod(i3, i4, i1 * i2 + 12345, i2);
+        assert(i3 == i1 && i4 == 12345);
+        i_divmod(i3, i4, -i1, i2 >> 9000);
+        assert(i3 == -i1 / (i2 >> 9000) && i4 == -i1 % (i2 >> 9000));
+        assert(Number(i1).str() == i1.str());
+        unsigned long long seed1 = 88172645463325252ULL;
+        for (size_t t = 1; t <= 3; ++t)
+        {
+            SetDivThreshold(t);
+            for (int k = 0; k < 300; ++k)
+            {
+                integer_type x, y;
+                for (int j = 0, nx = 1 + k % 13; j < nx; ++j)
+                {
+                    seed1 ^= seed1 << 13; seed1 ^= seed1 >> 7; seed1 ^= seed1 << 17;
+                    x = (x << 64) + seed1;
+                }
+                for (int j = 0, ny = 1 + k % 5; j < ny; ++j)
+                {
+                    seed1 ^= seed1 << 13; seed1 ^= seed1 >> 7; seed1 ^= seed1 << 17;
+                    y = (y << 64) + (seed1 >> (k % 64));
+                }
+                if (y.is_zero())
+                    continue;
+                if (k & 1)
+                    x = -x;
+                i_divmod(i3, i4, x, y);
+                assert(i3 == x / y && i4 == x % y);
+            }
+        }
+        SetDivThreshold(div_threshold);
+
+        assert(pmp::pow(Number(3), Number(200)).is_i());
+        assert(pmp::pow(Number(3), Number(200)) == Number(integer_type(b_mp::pow(integer_type(3), 200))));
+        assert(pmp::pow(Number(-2, 3), Number(5)) == Number(-32, 243));
+        assert(pmp::pow(Number(2), Number(-2)).is_r());
+        Number n46 = pmp::pow(Number(10), Number(pow10(12)));
+        assert(n46.is_f() && b_mp::isinf(n46.get_f()));
+        n46 = pmp::pow(Number(1, 3), Number(-pow10(12)));
+        assert(n46.is_f() && b_mp::isinf(n46.get_f()));
+        assert(pmp::pow(Number(-1), Number(pow10(12) + 1)) == -1);
+        assert(pmp::pow(Number(2), Number(-2)) == Number(1, 4));
+        assert(pmp::pow(Number(-1), Number("100000000000000000000001")) == -1);
+        assert(pmp::pow(Number(4), Number(0.5)).is_f());
+
+        ModContext mod_odd(integer_type(i2 >> 54000));
+        ModContext mod_even(integer_type((i2 >> 54000) + 1));
+        assert(mod_odd.powmod(i1, i2 >> 50000) == b_mp::powm(i1, i2 >> 50000, mod_odd.modulus()));
+        assert(mod_even.powmod(i1, i2 >> 50000) == b_mp::powm(i1, i2 >> 50000, mod_even.modulus()));
+        assert(mod_odd.mulmod(-i1, i2) == mod_odd.reduce(-i1 * i2));
+        assert(mod_odd.invmod(i4, 65537));
+        assert(mod_odd.mulmod(i4, 65537) == 1);
+        assert(bit_length(-i1) == bit_length(i1) && bit_length(i1) == b_mp::msb(i1) + 1);
+        assert(!mod_even.invmod(i4, 2));
+        assert(pmp::powmod(3, -1, 7) == 5);
+        assert(pmp::invmod(10, 17) == 12);
+        {
+            vector_type v2;
+            for (int i = 1; i <= 20; ++i)
+                v2.push_back(i);
+            Number n16 = ModContext(Number(101)).invmod(Number(v2));
+            for (size_t i = 0; i < v2.size(); ++i)
+                assert((n16[i] * v2[i]) % 101 == 1);
+        }
+
+        assert(pmp::gcd(Number(12), Number(-18)) == 6);
+        assert(pmp::lcm(Number(4), Number(6)) == 12);
+        assert(pmp::isqrt(Number(i_mul(i1, i1))) == Number(i1));
+        assert(pmp::isqrt(Number(integer_type(i1 * i1 - 1))) == Number(integer_type(i1 - 1)));
+        assert(i_iroot(i3, i_mul(i1, i_mul(i1, i1)), 3) && i3 == i1);
+        assert(!i_iroot(i3, integer_type(-28), 3) && i3 == -3);
+        assert(pmp::ilog2(Number(1024)) == 10 && pmp::ilog2(Number(1023)) == 9);
+        assert(is_prime(Number(65537)) && !is_prime(Number(65535)));
+        assert(is_prime(Number(integer_type((integer_type(1) << 521) - 1))));
+        assert(!is_prime(Number(3215031751LL)));    // strong pseudoprime to 2,3,5,7
+        {
+            vector_type v3;
+            for (int i = 0; i < 1000; ++i)
+                v3.push_back(i);
+            std::vector<bool> primes = is_prime(v3, 25, 4);
+            assert(std::count(primes.begin(), primes.end(), true) == 168);
+            assert(primes[997] && !primes[999]);
+        }
+
+        assert(pmp::factorial(Number(24)) == Number(integer_type("620448401733239439360000")));
+        assert(pmp::factorial(Number(0)) == 1 && pmp::factorial(Number(1)) == 1);
+        assert(pmp::factorial(Number(300)) == n11);
+        assert(pmp::binomial(Number(10), Number(3)) == 120);
+        assert(pmp::binomial(Number(5), Number(7)) == 0);
+        assert(i_binomial(1000, 400) * i_factorial(400) * i_factorial(600) == i_factorial(1000));
+        assert(i_binomial(100000, 5) * 120 ==
+               integer_type(100000) * 99999 * 99998 * 99997 * 99996);
+        assert(pmp::primorial(Number(30)) == Number(integer_type(6469693230LL)));
+        bool thrown2 = false;
+        try
+        {
+            pmp::primorial(Number(-3));
+        }
+        catch (std::domain_error&)
+        {
+            thrown2 = true;
+        }
+        assert(thrown2);
+        (void)thrown2;
+        {
+            struct ESeries  // e = sum 1/k!
+            {
+                integer_type p(unsigned long) const { return 1; }
+                integer_type q(unsigned long k) const { return k ? k : 1; }
+                integer_type a(unsigned long) const { return 1; }
+            };
+            floating_type e = series_sum(ESeries(), 80);
+            assert(b_mp::abs(e - b_mp::exp(floating_type(1))) < floating_type("1e-95"));
+            (void)e;
+        }
+
+        assert(i_constant(CONSTANT_PI, 50) ==
+               integer_type("314159265358979323846264338327950288419716939937510"));
+        assert(i_constant(CONSTANT_E, 30) == integer_type("2718281828459045235360287471352"));
+        assert(i_constant(CONSTANT_LN2, 30) == integer_type("693147180559945309417232121458"));
+        assert(i_constant(CONSTANT_LN10, 30) == integer_type("2302585092994045684017991454684"));
+        assert(i_constant(CONSTANT_SQRT2, 30) == integer_type("1414213562373095048801688724209"));
+        assert(i_constant(CONSTANT_PI, 1000) / pow10(950) == i_constant(CONSTANT_PI, 50));
+        assert(b_mp::abs(f_constant(CONSTANT_PI) - boost::math::constants::pi<floating_type>()) < floating_type("1e-99"));
+        assert(pmp::constant(CONSTANT_PI, 2) == Number(157, 50));
+        assert(b_mp::abs(f_sin(floating_type(1)) - b_mp::sin(floating_type(1))) < floating_type("1e-99"));
+        assert(b_mp::abs(f_cos(floating_type(-1e9)) - b_mp::cos(floating_type(-1e9))) < floating_type("1e-95"));
+        assert(b_mp::abs(f_sin(f_constant(CONSTANT_PI) * 100000000001LL)) < floating_type("1e-85"));
+        assert(b_mp::isfinite(f_sin(floating_type("1e300"))));
+        assert(b_mp::isnan(f_sin(floating_type("1e1000000"))));
+        assert(b_mp::isnan(f_cos(floating_type("-1e1000000"))));
+        assert(b_mp::isnan(f_tan(floating_type("1e1000000"))));
+        assert(b_mp::abs(f_log10(floating_type(1000)) - 3) < floating_type("1e-99"));
+        {
+            vector_type v4, v5;
+            for (int i = 1; i <= 40; ++i)
+                v4.push_back(Number(i * 7, 3));
+            exp_batch(v4, v5, 2);
+            assert(v5.size() == v4.size() && v5[39] == pmp::exp(v4[39]));
+            for (size_t i = 0; i < v4.size(); ++i)
+            {
+                floating_type x = v4[i].to_f();
+                assert(b_mp::abs(v5[i].get_f() / b_mp::exp(x) - 1) < floating_type("1e-99"));
+                assert(b_mp::abs(f_log(x) - b_mp::log(x)) < floating_type("1e-98"));
+                assert(b_mp::abs(f_sin(x) - b_mp::sin(x)) < floating_type("1e-98"));
+                (void)x;
+            }
+            log_batch(v4, v4);
+            assert(v4[0] == pmp::log(Number(7, 3)));
+            assert(pmp::cos(Number(v5)).size() == v5.size());
+        }
+
+        assert(Number(2).hash() == Number(4, 2).hash());
+        assert(Number(2).hash() == Number(2.0).hash());
+        assert(Number(-6, 2).hash() == Number(-3.0).hash());
+        assert(Number(0.5).hash() == Number(1, 2).hash());
+        assert(Number("123.456").hash() == Number(integer_type(123456), integer_type(1000)).hash());
+        assert(Number("1e-30").hash() == Number(integer_type(1), pow10(30)).hash());
+        assert(Number(b_mp::pow(floating_type(10), 150)).hash() == Number(pow10(150)).hash());
+        assert(Number(integer_type(-i1)).hash() == Number(integer_type(-i1 * 3), integer_type(3)).hash());
+        assert(Number(2).hash() != Number(3).hash());
+        assert(Number(1, 3) != Number(floating_type(1) / 3));
+        assert(Number(1, 3).compare(Number(floating_type(1) / 3)) ==
+               -Number(floating_type(1) / 3).compare(Number(1, 3)));
+        assert(Number(0.5) == Number(1, 2));
+        assert(Number(pow10(120) + 1) != Number(b_mp::pow(floating_type(10), 120)));
+        assert(Number(pow10(120)) == Number(b_mp::pow(floating_type(10), 120)));
+        assert(Number("1e-30") == Number(integer_type(1), pow10(30)));
+        {
+            Number n17(pow10(100));
+            size_t h17 = n17.hash();
+            n17.get_i() += 1;
+            assert(n17.hash() != h17);
+            (void)h17;
+            std::unordered_set<Number> set1;
+            set1.insert(Number(2));
+            set1.insert(Number(4, 2));
+            set1.insert(Number(2.0));
+            set1.insert(Number(1, 3));
+            assert(set1.size() == 2);
+        }
+        {
+            bool memo1 = pmp::SetMemoize(true);
+            pmp::ClearMemo();
+            Number n18 = pmp::exp(Number(3, 7));
+            Number n19 = pmp::exp(Number(3, 7));
+            assert(n18.get_f() == n19.get_f());
+            assert(pmp::exp(Number(3.0 / 7)).get_f() != n18.get_f());
+            assert(pmp::pow(Number(2), Number(10)) == 1024);
+            assert(pmp::pow(Number(2), Number(10)) == 1024);
+            pmp::MemoStats stats1 = pmp::GetMemoStats();
+            assert(stats1.hits == 2 && stats1.misses == 3 && stats1.size == 3);
+            (void)stats1;
+            n19.get_f() += 1;
+            assert(pmp::exp(Number(3, 7)).get_f() == n18.get_f());
+            size_t cap1 = pmp::SetMemoizeCapacity(0);
+            assert(pmp::GetMemoStats().size == 0);
+            pmp::SetMemoizeCapacity(cap1);
+            pmp::ClearMemo();
+            pmp::SetMemoize(memo1);
+        }
+        {
+            Number n20(5);
+            n20.get_i() += 1;
+            assert(n20 == 6 && Number(5) == 5);
+            Number n21(0.0);
+            n21.get_f() += 1;
+            assert(n21 == 1.0 && Number(0.0).is_zero() && Number(1.0).is_f());
+            Number n22;
+            ++n22;
+            assert(n22 == 1 && Number().is_zero());
+            assert(Number(-17) == -17 && Number(257) == 257);
+        }
+        {
+            Number n23(1, 3), n24;
+            {
+                pmp::Arena arena1(4096);
+                std::vector<int, pmp::PoolAllocator<int> > v6(1000, 7);
+                assert(arena1.used() >= 4000 && pmp::Arena::current() == &arena1);
+                Number n25;
+                for (int i = 1; i <= 1000; ++i)
+                    n25 += Number(i, 3) * n23;
+                assert(n25 == Number(500500, 9));
+                {
+                    pmp::Arena::Suspend suspend;
+                    assert(pmp::Arena::current() == NULL);
+                    n24 = n25.clone();
+                }
+            }
+            assert(pmp::Arena::current() == NULL);
+            assert(n24 == Number(500500, 9) && n23 == Number(1, 3));
+            void *p1 = pmp::pool_allocate(40);
+            pmp::pool_deallocate(p1);
+            void *p2 = pmp::pool_allocate(40);
+            assert(p2 == p1);
+            pmp::pool_deallocate(p2);
+        }
+        {
+            Number n26(pow10(30));
+            {
+                std::vector<Number> v7(100, n26);
+                Number n27 = v7[50];
+                assert(n27 == n26);
+            }
+            Number n28 = n26.share_across_threads();
+            assert(n28 == n26);
+            n28 = n28.clone();
+            n28.get_i() += 1;
+            assert(n26 == Number(pow10(30)) && n28 > n26);
+        }
+        {
+            Number n29(pow10(40)), n30(pow10(40)), n31(integer_type(7));
+            const integer_type *p2 = &n29.get_i();
+            pmp::add(n29, n29, n30);
+            pmp::mul(n29, n29, n31);
+            pmp::fma(n29, n30, n31, n29);
+            pmp::sub(n29, n29, n30);
+            assert(&n29.get_i() == p2 && n29 == Number(integer_type(20) * pow10(40)));
+            (void)p2;
+            Number n32 = n30;
+            pmp::add(n32, n30, n30);
+            assert(n30 == Number(pow10(40)) && n32 == Number(integer_type(2) * pow10(40)));
+            Number n33(2.5);
+            pmp::div(n33, n33, Number(0.5));
+            pmp::fma(n33, n33, Number(2), Number(1, 2));
+            assert(n33.is_f() && n33 == 10.5);
+            Number q1(pow10(30)), r1(pow10(30));
+            pmp::divmod(q1, r1, Number(-100), Number(7));
+            assert(q1 == -14 && r1 == -2);
+            pmp::divmod(q1, r1, Number(7, 2), Number(1, 3));
+            assert(q1.is_i() && q1 == 10 && r1 == Number(1, 6));
+            pmp::divmod(q1, r1, Number(7.5), Number(2));
+            assert(q1.is_f() && q1 == 3 && r1 == 1.5);
+        }
+#if !defined(PMP_INTDIV_INTEGER) && !defined(PMP_INTDIV_FLOATING) && !defined(PMP_INTDIV_RATIONAL)
+        {
+            Number::Type intdiv1 = pmp::SetIntDivType(Number::FLOATING);
+            assert((Number(pow10(40)) / Number(-pow10(20))).is_i());
+            assert(Number(pow10(40)) / Number(-pow10(20)) == Number(integer_type(-pow10(20))));
+            assert(Number(7) / Number(2) == 3.5);
+            assert((Number(7) / Number(0)).is_f());
+            pmp::SetIntDivType(Number::RATIONAL);
+            assert((Number(6) / Number(3)).is_r() && Number(6) / Number(3) == 2);
+            assert(Number(7) / Number(2) == Number(7, 2));
+            pmp::SetIntDivType(Number::INTEGER);
+            assert(Number(-7) / Number(2) == -3);
+            pmp::SetIntDivType(intdiv1);
+        }
+#endif
+        {
+            Number n34(floating_type("2.99999999999999999999"));
+            n34.trim(10);
+            assert(n34.is_i() && n34 == 3);
+            Number n35(floating_type("0.125"));
+            n35.trim(2);
+            assert(n35.is_f() && n35 == floating_type("0.12"));
+            Number n36(floating_type("-1.234567890123456789012345e40"));
+            assert(n36.to_i() == integer_type("-12345678901234567890123450000000000000000"));
+            n36.demote();
+            assert(n36.is_i() && n36 == Number(integer_type("-12345678901234567890123450000000000000000")));
+            Number n37(3, 1);
+            n37.demote();
+            assert(n37.is_i() && n37 == 3);
+            bool demote1 = pmp::SetAutoDemote(true);
+            Number n38 = Number(1.5) + Number(2.5);
+            assert(n38.is_i() && n38 == 4);
+            n38 = Number(1, 3) * Number(6);
+            assert(n38.is_i() && n38 == 2);
+            n38 = Number(1.5) * Number(3);
+            assert(n38.is_f());
+            Number n47(0.5), n48(1, 2);
+            pmp::add(n47, Number(1.5), Number(2.5));
+            assert(n47.is_i() && n47 == 4);
+            pmp::mul(n48, Number(1, 3), Number(6));
+            assert(n48.is_i() && n48 == 2);
+            n47 = Number(0.5);
+            pmp::fma(n47, Number(1.5), Number(2), Number(1.0));
+            assert(n47.is_i() && n47 == 4);
+            bool lazy2 = pmp::SetLazyRational(true);
+            n38 = Number(2, 3) + Number(4, 3);
+            assert(n38.is_i() && n38 == 2);
+            pmp::SetAutoDemote(false);
+            n38 = Number(2, 3) + Number(4, 3);
+            assert(n38.is_r());
+            n38.demote();
+            assert(n38.is_i() && n38 == 2);
+            n38 = Number(2, 3) + Number(1, 3) * Number(5);
+            n38.demote();
+            assert(n38.is_r() && n38 == Number(7, 3));
+            pmp::SetLazyRational(lazy2);
+            pmp::SetAutoDemote(demote1);
+        }
+        {
+            std::string text1 = "1, -2\r\n123456789012345678901234567890\n\n2.5,1/3 , 0x10\n-7";
+            pmp::NumberReader reader1(3, 4);
+            vector_type v8;
+            reader1.read(text1.data(), text1.size(), v8);
+            assert(v8.size() == 7);
+            assert(v8[0] == 1 && v8[1] == -2 && v8[6] == -7);
+            assert(v8[2] == Number(integer_type("123456789012345678901234567890")));
+            assert(v8[3].is_f() && v8[3] == 2.5 && v8[4] == Number(1, 3) && v8[5] == 16);
+            std::istringstream iss1(text1);
+            vector_type v9;
+            reader1.read(iss1, v9);
+            assert(v9 == v8);
+            {
+                std::ofstream fout("PmpNumberReader.tmp", std::ios::binary);
+                fout << text1;
+            }
+            vector_type v10;
+            bool read1 = reader1.read_file("PmpNumberReader.tmp", v10);
+            assert(read1 && v10 == v8);
+            std::remove("PmpNumberReader.tmp");
+            read1 = reader1.read_file("PmpNumberReader.tmp", v10);
+            assert(!read1);
+            (void)read1;
+            assert(pmp::NumberReader::parse(text1.data(), text1.data() + 1) == 1);
+            std::string text2 = "010, -010, 0, -0";
+            vector_type v11;
+            reader1.read(text2.data(), text2.size(), v11);
+            assert(v11.size() == 4);
+            assert(v11[0] == Number("010") && v11[0] == 8 && v11[1] == -8);
+            assert(v11[2] == 0 && v11[3] == 0);
+        }
+        {
+            Number n39(integer_type(-3) * pow10(60));
+            std::string bin1 = n39.serialize();
+            assert(bin1.size() < n39.str().size());
+            Number n40(pow10(70));
+            const integer_type *p3 = &n40.get_i();
+            size_t read2 = n40.deserialize(bin1);
+            assert(read2 == bin1.size());
+            (void)read2;
+            assert(&n40.get_i() == p3 && n40 == n39);
+            (void)p3;
+            Number n41(floating_type(-1) / 3);
+            n40.deserialize(n41.serialize());
+            assert(n40.is_f() && n40.get_f() == n41.get_f());
+            Number n42("1,2/3,-4.25,123456789012345678901234567890");
+            n40.deserialize(n42.serialize());
+            assert(n40.is_v() && n40 == n42 && n40[1].is_r());
+            n40.deserialize(Number(-7).serialize());
+            assert(n40 == -7);
+            bool thrown1 = false;
+            try
+            {
+                n40.deserialize(bin1.substr(0, 5));
+            }
+            catch (std::domain_error&)
+            {
+                thrown1 = true;
+            }
+            assert(thrown1);
+            // 10^6 rationals nested in each other's numerators
+            std::string bin2(1, '\x01');
+            bin2.append(1000000, '\x02');
+            thrown1 = false;
+            try
+            {
+                n40.deserialize(bin2);
+            }
+            catch (std::domain_error&)
+            {
+                thrown1 = true;
+            }
+            assert(thrown1);
+            (void)thrown1;
+        }
+        {
+            std::remove("PmpNumberStore.tmp");
+            vector_type v11, v12;
+            v11.push_back(Number(-5));
+            v11.push_back(Number(0.25));
+            v11.push_back(Number(pow10(40)));
+            v11.push_back(Number(1, 3));
+            v12.push_back(Number(floating_type(1) / 3));
+            v12.push_back(Number(123456789));
+            bool appended1 = pmp::NumberStore::append("PmpNumberStore.tmp", v11);
+            assert(appended1);
+            pmp::NumberStore store1("PmpNumberStore.tmp");
+            assert(store1.is_open() && store1.size() == 4);
+            appended1 = store1.append(v12);
+            assert(appended1 && store1.size() == 6 && store1.segment_count() == 2);
+            __int64 i64 = 0;
+            double d1 = 0;
+            bool got1 = store1.get_int64(0, i64);
+            assert(got1 && i64 == -5);
+            got1 = store1.get_int64(1, i64);
+            assert(!got1);
+            got1 = store1.get_double(1, d1);
+            assert(got1 && d1 == 0.25);
+            (void)got1;
+            assert(store1.kind(2) == pmp::NumberStore::KIND_HEAP && store1[2] == Number(pow10(40)));
+            assert(store1[3] == Number(1, 3) && store1[4] == v12[0] && store1[5] == 123456789);
+            vector_type v13;
+            store1.slice(3, 5, v13);
+            assert(v13.size() == 2 && v13[0] == Number(1, 3) && v13[1] == v12[0]);
+            store1.close();
+            {
+                // a torn append: half a segment header at the end
+                std::ofstream fout("PmpNumberStore.tmp", std::ios::binary | std::ios::app);
+                fout.write("PMPSEG\x01\0\x05\0\0", 11);
+            }
+            store1.open("PmpNumberStore.tmp");
+            assert(store1.is_open() && store1.size() == 6 && store1[5] == 123456789);
+            appended1 = store1.append(v11);
+            assert(appended1 && store1.size() == 10 && store1.segment_count() == 3);
+            assert(store1[6] == -5 && store1[9] == Number(1, 3));
+            store1.close();
+            {
+                std::ofstream fout("PmpNumberStore.tmp", std::ios::binary | std::ios::app);
+                fout.write("garbage!", 8);
+            }
+            store1.open("PmpNumberStore.tmp");
+            assert(!store1.is_open());
+            appended1 = pmp::NumberStore::append("PmpNumberStore.tmp", v11);
+            assert(!appended1);
+            std::remove("PmpNumberStore.tmp");
+            vector_type v14;
+            v14.push_back(Number(pow10(40)));
+            v14.push_back(Number(pow10(50)));
+            appended1 = pmp::NumberStore::append("PmpNumberStore.tmp", v14);
+            assert(appended1);
+            (void)appended1;
+            {
+                // stretch the first heap span over a byte of the second
+                std::fstream file("PmpNumberStore.tmp",
+                                  std::ios::in | std::ios::out | std::ios::binary);
+                file.seekg(64);
+                unsigned char offset1 = static_cast<unsigned char>(file.get());
+                file.seekp(64);
+                file.put(static_cast<char>(offset1 + 1));
+            }
+            store1.open("PmpNumberStore.tmp");
+            bool thrown3 = false;
+            try
+            {
+                store1[0];
+            }
+            catch (std::domain_error&)
+            {
+                thrown3 = true;
+            }
+            assert(thrown3);
+            (void)thrown3;
+            store1.close();
+            std::remove("PmpNumberStore.tmp");
+        }
+        {
+            const double d2[] = { 0.0, 1.0, -2.5, 0.1, 1e300, -3e-7 };
+            Number n43 = from_doubles(d2, 6);
+            assert(n43.size() == 6 && n43[3].is_f() && n43[3] == Number(0.1));
+            double d3[6];
+            size_t written1 = to_doubles(n43, d3, 6);
+            assert(written1 == 6);
+            for (size_t k = 0; k < 6; ++k)
+                assert(d3[k] == d2[k]);
+            Number n44("7,1/3,-2.75,18446744073709551616,1e+19");
+            written1 = to_doubles(n44, d3, 6);
+            assert(written1 == 5 && d3[1] == 1.0 / 3 && d3[3] == 18446744073709551616.0);
+            written1 = to_doubles(floating_type(2) / 3, d3, 1);
+            assert(written1 == 1 && d3[0] == Number(floating_type(2) / 3).convert_to<double>());
+            __int64 i2[5];
+            size_t overflows1 = 0;
+            written1 = to_int64s(n44, i2, 5, &overflows1);
+            assert(written1 == 5 && overflows1 == 2);
+            assert(i2[0] == 7 && i2[1] == 0 && i2[2] == -2);
+            assert(i2[3] == (std::numeric_limits<__int64>::max)() && i2[4] == i2[3]);
+            const __int64 i3[] = { -9, (std::numeric_limits<__int64>::min)() };
+            Number n45 = from_int64s(i3, 2);
+            written1 = to_int64s(n45, i2, 5, &overflows1);
+            assert(n45[0].is_i() && written1 == 2 && overflows1 == 0);
+            (void)written1;
+            assert(i2[0] == -9 && i2[1] == i3[1]);
+        }
+        {
+            const char *strs1[] = { "12", " 1/3 ", "2.5", "x" };
+            pmp_number h1[4] = { NULL, NULL, NULL, NULL };
+            pmp_number h2[4] = { NULL, NULL, NULL, NULL };
+            size_t failed1 = pmp_parse_n(strs1, NULL, 4, h1);
+            assert(failed1 == 1 && h1[3] == NULL);
+            assert(std::string(pmp_last_error()).find("element 3") != std::string::npos);
+            failed1 = pmp_mul_n(h1, h1, 3, h2);
+            assert(failed1 == 0 && *reinterpret_cast<Number *>(h2[1]) == Number(1, 9));
+            pmp_number kept1 = h2[0];
+            failed1 = pmp_add_n(h2, h1, 4, h2);
+            assert(failed1 == 1 && h2[0] == kept1 && h2[3] == NULL);
+            (void)kept1;
+            assert(*reinterpret_cast<Number *>(h2[0]) == 156 && *pmp_last_error() != '\0');
+            char buf1[64];
+            size_t offsets1[4];
+            size_t len1 = pmp_format_n(h2, 3, '\n', buf1, sizeof(buf1), offsets1);
+            assert(len1 == 13);
+            assert(std::string(buf1, offsets1[2]) == "156\n4/9\n" && offsets1[3] == 13);
+            len1 = pmp_format_n(h2, 3, '\n', buf1, 5, NULL);
+            assert(len1 == 13 && std::string(buf1) == "156\n");
+            (void)len1;
+            double d4[3];
+            long long i4[3];
+            failed1 = pmp_to_doubles(h2, 3, d4);
+            assert(failed1 == 0 && d4[2] == 8.75);
+            failed1 = pmp_to_int64s(h2, 3, i4);
+            assert(failed1 == 0 && i4[0] == 156 && i4[1] == 0 && i4[2] == 8);
+            (void)failed1;
+            pmp_free_n(h1, 4);
+            pmp_free_n(h2, 4);
+            assert(h1[0] == NULL && h2[2] == NULL);
+        }
+        std::cout << "n11" << std::endl;
+        std::cout << n11 << std::endl;
+
         return 0;
     }
 #endif  // def UNITTEST
@@ -16,12 +16,17 @@
 #include <vector>       // for std::vector
 #include <cmath>        // for math functions
 #include <cassert>      // for assert
+#include <atomic>       // for std::atomic
+#include <stdexcept>    // for std::domain_error
+
+#if !defined(_MSC_VER) && !defined(__MINGW32__) && !defined(__int64)
+    #define __int64 long long   // as MinGW defines it
+#endif
 
 /////////////////////////////////////////////////////////////////////////////
 // smart pointers
 
-#include <boost/shared_ptr.hpp>
-#include <boost/make_shared.hpp>
+#include <boost/intrusive_ptr.hpp>
 
 /////////////////////////////////////////////////////////////////////////////
 // Boost.Multiprecision
@@ -32,13 +37,176 @@
 #define b_mp        boost::multiprecision
 
 /////////////////////////////////////////////////////////////////////////////
+// allocation
 
 namespace pmp
 {
+    // Blocks are recycled through per-thread free lists sorted by size.
+    // While an Arena is active on the calling thread, blocks come from the
+    // arena instead; the arena reuses the ones freed while it is current
+    // and releases all of them when it is destroyed.  A block may be freed
+    // on any thread.
+    void *pool_allocate(size_t size);
+    void pool_deallocate(void *p);
+
+    struct pool_tag { };
+
+    template <typename T>
+    inline void pool_delete(T *p)
+    {
+        if (p)
+        {
+            p->~T();
+            pool_deallocate(p);
+        }
+    }
+
+    template <typename T>
+    class PoolAllocator
+    {
+    public:
+        typedef T               value_type;
+        typedef T *             pointer;
+        typedef const T *       const_pointer;
+        typedef T&              reference;
+        typedef const T&        const_reference;
+        typedef size_t          size_type;
+        typedef ptrdiff_t       difference_type;
+
+        template <typename U>
+        struct rebind
+        {
+            typedef PoolAllocator<U> other;
+        };
+
+        PoolAllocator() { }
+        template <typename U>
+        PoolAllocator(const PoolAllocator<U>&) { }
+
+        pointer address(reference x) const { return &x; }
+        const_pointer address(const_reference x) const { return &x; }
+
+        pointer allocate(size_type n, const void * = NULL)
+        {
+            return static_cast<pointer>(pool_allocate(n * sizeof(T)));
+        }
+
+        void deallocate(pointer p, size_type)
+        {
+            pool_deallocate(p);
+        }
+
+        size_type max_size() const
+        {
+            return static_cast<size_type>(-1) / sizeof(T);
+        }
+
+        void construct(pointer p, const T& x) { new(p) T(x); }
+        void destroy(pointer p) { p->~T(); }
+    };
+
+    template <typename T, typename U>
+    inline bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&)
+    {
+        return true;
+    }
+
+    template <typename T, typename U>
+    inline bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&)
+    {
+        return false;
+    }
+
+    // Bump allocator for a region of code.  Every Number temporary created
+    // on this thread while the arena is alive (with PMP_USE_POOL_ALLOCATOR)
+    // lives in it, and all of them are freed at once by the destructor, so
+    // none of them may outlive the arena.  Keep results with clone() inside
+    // a Suspend scope.  Arenas nest and must be destroyed in reverse order
+    // on the thread that created them.
+    class Arena
+    {
+    public:
+        explicit Arena(size_t chunk_size = 64 * 1024);
+        ~Arena();
+
+        size_t used() const { return m_used; }  // bytes handed out
+        static Arena *current();                // on this thread
+
+        // allocations in this scope bypass the current arena
+        class Suspend
+        {
+        public:
+            Suspend();
+            ~Suspend();
+
+        private:
+            Arena *m_arena;
+            Suspend(const Suspend&);
+            Suspend& operator=(const Suspend&);
+        };
+
+        void *allocate(size_t size);
+
+    protected:
+        friend void *pool_allocate(size_t size);
+        friend void pool_deallocate(void *p);
+
+        struct Chunk;
+        struct Free;
+        static const size_t s_free_lists = 33;  // the pool size classes
+        Free *      m_free[s_free_lists];
+        Arena *     m_outer;
+        Chunk *     m_chunks;
+        size_t      m_chunk_size;
+        char *      m_next;
+        char *      m_end;
+        size_t      m_used;
+
+    private:
+        Arena(const Arena&);
+        Arena& operator=(const Arena&);
+    };
+} // namespace pmp
+
+inline void *operator new(size_t size, pmp::pool_tag)
+{
+    return pmp::pool_allocate(size);
+}
+
+inline void operator delete(void *p, pmp::pool_tag)
+{
+    pmp::pool_deallocate(p);
+}
+
+// blocks of Number
+#ifdef PMP_USE_POOL_ALLOCATOR
+    #define PMP_NEW             new(pmp::pool_tag())
+    #define PMP_DELETE(p)       pmp::pool_delete(p)
+    #define PMP_ALLOCATE(size)  pmp::pool_allocate(size)
+    #define PMP_DEALLOCATE(p)   pmp::pool_deallocate(p)
+#else
+    #define PMP_NEW             new
+    #define PMP_DELETE(p)       delete (p)
+    #define PMP_ALLOCATE(size)  ::operator new(size)
+    #define PMP_DEALLOCATE(p)   ::operator delete(p)
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+
+namespace pmp
+{
+#ifdef PMP_USE_POOL_ALLOCATOR
+    // limbs come from the pools and arenas too
+    typedef b_mp::cpp_int_backend<0, 0, b_mp::signed_magnitude, b_mp::unchecked,
+                                  PoolAllocator<b_mp::limb_type> > integer_backend;
+    typedef b_mp::number<integer_backend>                       integer_type;
+    typedef b_mp::number<b_mp::rational_adaptor<integer_backend> >  rational_type;
+#else
     typedef b_mp::cpp_int               integer_type;
+    typedef b_mp::cpp_rational          rational_type;
+#endif
     //typedef b_mp::cpp_dec_float_50      floating_type;
     typedef b_mp::cpp_dec_float_100     floating_type;
-    typedef b_mp::cpp_rational          rational_type;
     static const unsigned s_default_precision = 100;
 
     inline floating_type i_to_f(const integer_type& i)
@@ -66,6 +234,149 @@ namespace pmp
         return floating_type(r);
     }
 
+    //
+    // multiplication engine
+    //
+    // Operands are dispatched on their size in limbs: cpp_int below the
+    // Karatsuba threshold, then Karatsuba, Toom-3 and a three-prime
+    // number-theoretic transform.  A threshold of 0 disables its tier.
+    //
+    struct MulThresholds
+    {
+        size_t karatsuba;
+        size_t toom3;
+        size_t ntt;
+    };
+    MulThresholds SetMulThresholds(const MulThresholds& thresholds);
+    MulThresholds GetMulThresholds();
+
+    void i_mul(integer_type& result, const integer_type& a, const integer_type& b);
+    void i_sqr(integer_type& result, const integer_type& a);
+
+    inline integer_type i_mul(const integer_type& a, const integer_type& b)
+    {
+        integer_type result;
+        i_mul(result, a, b);
+        return result;
+    }
+
+    //
+    // division engine
+    //
+    // Above the threshold (in limbs, for both the divisor and the quotient)
+    // the quotient comes from a Newton reciprocal and fast multiplication.
+    // Results truncate toward zero like cpp_int.
+    //
+    size_t SetDivThreshold(size_t limbs);
+    void i_divmod(integer_type& q, integer_type& r,
+                  const integer_type& a, const integer_type& b);
+    std::string i_to_str(const integer_type& i);    // decimal
+
+    // base^e by squaring and multiplying
+    void i_pow(integer_type& result, const integer_type& base, unsigned long e);
+
+    // balanced products of small factors
+    integer_type i_factorial(unsigned long n);
+    integer_type i_binomial(unsigned long n, unsigned long k);
+    integer_type i_primorial(unsigned long n);      // product of primes <= n
+
+    //
+    // binary splitting for series
+    //
+    //     S = sum[k = first .. last-1] a(k) * (p(first) ... p(k)) / (q(first) ... q(k))
+    //
+    // Series must provide integer_type p(k), q(k) and a(k).  On return
+    // S == T / Q and P is the product of the p(k).
+    //
+    template <typename Series>
+    void binary_split(integer_type& P, integer_type& Q, integer_type& T,
+                      const Series& series, unsigned long first, unsigned long last)
+    {
+        assert(first < last);
+        if (last - first == 1)
+        {
+            P = series.p(first);
+            Q = series.q(first);
+            T = i_mul(series.a(first), P);
+            return;
+        }
+
+        unsigned long mid = first + (last - first) / 2;
+        integer_type P2, Q2, T2;
+        binary_split(P, Q, T, series, first, mid);
+        binary_split(P2, Q2, T2, series, mid, last);
+
+        // T = T1 Q2 + P1 T2, P = P1 P2, Q = Q1 Q2
+        T = i_mul(T, Q2);
+        T += i_mul(P, T2);
+        P = i_mul(P, P2);
+        Q = i_mul(Q, Q2);
+    }
+
+    template <typename Series>
+    floating_type series_sum(const Series& series, unsigned long terms)
+    {
+        if (terms == 0)
+            return 0;
+        integer_type P, Q, T;
+        binary_split(P, Q, T, series, 0, terms);
+        return floating_type(T) / floating_type(Q);
+    }
+
+    //
+    // mathematical constants
+    //
+    // Each constant is computed once (Chudnovsky for pi, binary splitting
+    // for the rest) and cached; asking for more digits than the cache
+    // holds recomputes it at the higher precision.  Lock-free and
+    // thread-safe.
+    //
+    enum ConstantType
+    {
+        CONSTANT_PI, CONSTANT_E, CONSTANT_LN2, CONSTANT_LN10, CONSTANT_SQRT2,
+        CONSTANT_COUNT
+    };
+    integer_type i_constant(ConstantType c, size_t digits);   // floor(c * 10^digits)
+    const floating_type& f_constant(ConstantType c);          // floating_type precision
+
+    // floating functions; table-driven series after reduction against
+    // the cached constants
+    floating_type f_exp(const floating_type& f);
+    floating_type f_log(const floating_type& f);
+    floating_type f_sin(const floating_type& f);
+    floating_type f_cos(const floating_type& f);
+    floating_type f_tan(const floating_type& f);
+    floating_type f_log10(const floating_type& f);
+
+    //
+    // pmp::lazy_rational --- a numerator/denominator pair that is not
+    // reduced until it has to be.  The denominator is always positive.
+    //
+    struct lazy_rational
+    {
+        integer_type num;
+        integer_type den;
+
+        lazy_rational() : num(0), den(1) { }
+
+        lazy_rational(const integer_type& n, const integer_type& d) :
+            num(n), den(d)
+        {
+        }
+
+        explicit lazy_rational(const rational_type& r) :
+            num(b_mp::numerator(r)), den(b_mp::denominator(r))
+        {
+        }
+
+        rational_type normalized() const
+        {
+            return rational_type(num, den);
+        }
+
+        void reduce();      // divides out the gcd
+    };
+
     inline void split(const std::string& str, char sep, std::vector<std::string>& vec)
     {
         int i = 0, j = str.find_first_of(sep);
@@ -94,42 +405,42 @@ namespace pmp
         };
         typedef std::vector<Number> vector_type;
 
-        Number()                        : m_inner(boost::make_shared<Inner>(0)) { }
-        Number(int i)                   : m_inner(boost::make_shared<Inner>(i)) { }
-        Number(__int64 i)               : m_inner(boost::make_shared<Inner>(i)) { }
-        Number(double f)                : m_inner(boost::make_shared<Inner>(f)) { }
-        Number(long double f)           : m_inner(boost::make_shared<Inner>(f)) { }
-        Number(const integer_type& i)   : m_inner(boost::make_shared<Inner>(i)) { }
-        Number(const floating_type& f)  : m_inner(boost::make_shared<Inner>(f)) { }
-        Number(const rational_type& r)  : m_inner(boost::make_shared<Inner>(r)) { }
+        Number()                        : m_inner(make_inner(0)) { }
+        Number(int i)                   : m_inner(make_inner(i)) { }
+        Number(__int64 i)               : m_inner(make_inner(i)) { }
+        Number(double f)                : m_inner(make_inner(f)) { }
+        Number(long double f)           : m_inner(new_inner(f)) { }
+        Number(const integer_type& i)   : m_inner(new_inner(i)) { }
+        Number(const floating_type& f)  : m_inner(new_inner(f)) { }
+        Number(const rational_type& r)  : m_inner(new_inner(r)) { }
 
-        Number(int num, int denom) : m_inner(boost::make_shared<Inner>(num, denom))
+        Number(int num, int denom) : m_inner(new_inner(num, denom))
         {
         }
 
         Number(__int64 num, __int64 denom) :
-            m_inner(boost::make_shared<Inner>(num, denom))
+            m_inner(new_inner(num, denom))
         {
         }
 
         Number(const integer_type& num, const integer_type& denom) :
-            m_inner(boost::make_shared<Inner>(num, denom))
+            m_inner(new_inner(num, denom))
         {
         }
 
         Number(const Number& num, const Number& denom) :
-            m_inner(boost::make_shared<Inner>(num.to_i(), denom.to_i()))
+            m_inner(new_inner(num.to_i(), denom.to_i()))
         {
         }
 
         Number(const std::string& num, const std::string& denom) :
-            m_inner(boost::make_shared<Inner>(integer_type(num), integer_type(denom)))
+            m_inner(new_inner(integer_type(num), integer_type(denom)))
         {
         }
 
 #ifndef PMP_DISABLE_VECTOR
         Number(const vector_type& vec) :
-            m_inner(boost::make_shared<Inner>(vector_type(vec)))
+            m_inner(new_inner(vec))
         {
         }
 #endif
@@ -146,22 +457,22 @@ namespace pmp
 
         void assign(const integer_type& i)
         {
-            m_inner = boost::make_shared<Inner>(i);
+            m_inner = new_inner(i);
         }
 
         void assign(const floating_type& f)
         {
-            m_inner = boost::make_shared<Inner>(f);
+            m_inner = new_inner(f);
         }
 
         void assign(const rational_type& r)
         {
-            m_inner = boost::make_shared<Inner>(r);
+            m_inner = new_inner(r);
         }
 
         void assign(const std::string& str)
         {
-            m_inner = boost::make_shared<Inner>(str);
+            m_inner = new_inner(str);
         }
 
         void assign(const Number& num)
@@ -210,15 +521,15 @@ namespace pmp
 
         Type type() const  { return m_inner->m_type; }
 
-              integer_type&   get_i()       { assert(is_i()); return *m_inner.get()->m_integer;  }
-        const integer_type&   get_i() const { assert(is_i()); return *m_inner->m_integer;        }
-              floating_type&  get_f()       { assert(is_f()); return *m_inner.get()->m_floating; }
-        const floating_type&  get_f() const { assert(is_f()); return *m_inner->m_floating;       }
-              rational_type&  get_r()       { assert(is_r()); return *m_inner.get()->m_rational; }
-        const rational_type&  get_r() const { assert(is_r()); return *m_inner->m_rational;       }
+              integer_type&   get_i()       { assert(is_i()); unshare(); m_inner->m_hash.store(0, std::memory_order_relaxed); return m_inner->integer();  }
+        const integer_type&   get_i() const { assert(is_i()); return m_inner->integer();         }
+              floating_type&  get_f()       { assert(is_f()); unshare(); m_inner->m_hash.store(0, std::memory_order_relaxed); return m_inner->floating(); }
+        const floating_type&  get_f() const { assert(is_f()); return m_inner->floating();        }
+              rational_type&  get_r()       { assert(is_r()); m_inner->m_hash.store(0, std::memory_order_relaxed); return const_cast<rational_type&>(m_inner->rational()); }
+        const rational_type&  get_r() const { assert(is_r()); return m_inner->rational(); }
 #ifndef PMP_DISABLE_VECTOR
-                 vector_type& get_v()       { assert(is_v()); return *m_inner.get()->m_vector;   }
-           const vector_type& get_v() const { assert(is_v()); return *m_inner->m_vector;         }
+                 vector_type& get_v()       { assert(is_v()); m_inner->m_hash.store(0, std::memory_order_relaxed); return m_inner->vector();   }
+           const vector_type& get_v() const { assert(is_v()); return m_inner->vector();          }
 #endif
 
         integer_type    to_i() const;   // to integer
@@ -227,6 +538,7 @@ namespace pmp
 #ifndef PMP_DISABLE_VECTOR
         vector_type     to_v() const;   // to vector
 #endif
+        lazy_rational   to_lazy() const;  // to unreduced rational
 
         floating_type   i_to_f() const    { return pmp::i_to_f(get_i()); }
         rational_type   i_to_r() const    { return pmp::i_to_r(get_i()); }
@@ -235,7 +547,19 @@ namespace pmp
         integer_type    r_to_i() const    { return pmp::r_to_i(get_r()); }
         floating_type   r_to_f() const    { return pmp::r_to_f(get_r()); }
 
+        // rounds floats to precision digits after the point, then demotes
+        // integral floats and rationals with denominator 1 to integers
         void trim(unsigned precision = s_default_precision);
+        // demotes exactly: integral floats within digits10 and rationals
+        // with denominator 1 become integers, nothing is rounded
+        void demote();
+
+        // is this a rational that has not been reduced yet?
+        bool is_lazy() const
+        {
+            return is_r() && m_inner->m_rational.load(std::memory_order_acquire) == NULL;
+        }
+        void normalize();   // reduces lazy rationals
 
         template <typename T>
         T convert_to();
@@ -267,9 +591,55 @@ namespace pmp
             return compare(static_cast<Number>(d));
         }
 
+        // Mixed types compare by exact value, so 1/3 is not equal to
+        // 1.0/3 even though they agree to every digit of floating_type.
         void compare(const Number& num, bool comparisons[3]) const;
         int compare(const Number& num) const;
 
+        // Numbers that compare equal hash alike whatever their type, so 2,
+        // 4/2 and 2.0 (and 0.5 and 1/2) collide.  Cached for large values.
+        size_t hash() const;
+
+        // deep copy; copies otherwise share their value
+        Number clone() const;
+
+        // The value of this number, writable in place, when it has the
+        // given type and no other Number shares it; NULL otherwise.
+        integer_type *  reuse_i();
+        floating_type * reuse_f();
+        rational_type * reuse_r();
+
+        // Compact binary form: a version byte, then a type tag and the
+        // value (see "serialization" in PmpNumber.cpp).  serialize appends
+        // to out.  deserialize decodes into this number, writing into its
+        // storage when it is unshared, and returns the bytes it read.  Bad
+        // data, or values nested more than 256 deep, throw domain_error.
+        void serialize(std::string& out) const;
+        std::string serialize() const
+        {
+            std::string out;
+            serialize(out);
+            return out;
+        }
+        size_t deserialize(const char *data, size_t size);
+        size_t deserialize(const std::string& data)
+        {
+            return deserialize(data.data(), data.size());
+        }
+
+        // With PMP_SINGLE_THREADED the reference counts are not atomic and
+        // a number must stay on its thread.  This returns a copy sharing
+        // nothing with it, which may be handed to another thread as long
+        // as no copy of it stays behind.
+        Number share_across_threads() const
+        {
+#ifdef PMP_SINGLE_THREADED
+            return clone();
+#else
+            return *this;
+#endif
+        }
+
         void swap(Number& num)
         {
             m_inner.swap(num.m_inner);
@@ -334,13 +704,13 @@ namespace pmp
             switch (num1.type())
             {
             case Number::INTEGER:
-                return Number(static_cast<integer_type>(-(*num1.m_inner->m_integer)));
+                return Number(static_cast<integer_type>(-num1.m_inner->integer()));
 
             case Number::FLOATING:
-                return Number(static_cast<floating_type>(-(*num1.m_inner->m_floating)));
+                return Number(static_cast<floating_type>(-num1.m_inner->floating()));
 
             case Number::RATIONAL:
-                return Number(static_cast<rational_type>(-(*num1.m_inner->m_rational)));
+                return Number(static_cast<rational_type>(-num1.get_r()));
 
 #ifndef PMP_DISABLE_VECTOR
             case Number::VECTOR:
@@ -436,183 +806,167 @@ namespace pmp
         }
 
     protected:  // inner
+        // An Inner is a header followed, in the same block, by the payload
+        // its type calls for: integer_type, floating_type, rational_type,
+        // lazy_rational or vector_type.  Inners are made by create() and
+        // friends and freed by destroy(), never by new and delete.
         struct Inner
         {
             Type                m_type;
-            integer_type *      m_integer;
-            floating_type *     m_floating;
-            rational_type *     m_rational;
-#ifndef PMP_DISABLE_VECTOR
-            vector_type *       m_vector;
+            bool                m_lazy;             // payload is a lazy_rational
+            bool                m_interned;         // in the shared table
+#ifdef PMP_SINGLE_THREADED
+            mutable size_t      m_refs;
+#else
+            mutable std::atomic<size_t> m_refs;
 #endif
+            mutable std::atomic<size_t> m_hash;     // 0 until computed
+            // the payload of a rational; a lazy rational gets a block of
+            // its own on first use
+            mutable std::atomic<rational_type *> m_rational;
 
-            Inner() :
-                m_type(INTEGER),
-                m_integer(new integer_type()),
-                m_floating(NULL),
-                m_rational(NULL)
-#ifndef PMP_DISABLE_VECTOR
-                , m_vector(NULL)
-#endif
-            {
-            }
+            static const size_t s_payload_align = 16;
 
-            Inner(int i) :
-                m_type(INTEGER),
-                m_integer(new integer_type(i)),
-                m_floating(NULL),
-                m_rational(NULL)
-#ifndef PMP_DISABLE_VECTOR
-                , m_vector(NULL)
-#endif
+            static size_t header_size()
             {
+                return (sizeof(Inner) + s_payload_align - 1) /
+                       s_payload_align * s_payload_align;
             }
 
-            explicit Inner(__int64 i) :
-                m_type(INTEGER),
-                m_integer(new integer_type(i)),
-                m_floating(NULL),
-                m_rational(NULL)
-#ifndef PMP_DISABLE_VECTOR
-                , m_vector(NULL)
-#endif
-            {
-            }
+                  void *payload()       { return reinterpret_cast<char *>(this) + header_size(); }
+            const void *payload() const { return reinterpret_cast<const char *>(this) + header_size(); }
 
-            Inner(double f) :
-                m_type(FLOATING),
-                m_integer(NULL),
-                m_floating(new floating_type(f)),
-                m_rational(NULL)
+                  integer_type&  integer()        { return *static_cast<integer_type *>(payload()); }
+            const integer_type&  integer()  const { return *static_cast<const integer_type *>(payload()); }
+                  floating_type& floating()       { return *static_cast<floating_type *>(payload()); }
+            const floating_type& floating() const { return *static_cast<const floating_type *>(payload()); }
+                  lazy_rational& lazy()           { return *static_cast<lazy_rational *>(payload()); }
+            const lazy_rational& lazy()     const { return *static_cast<const lazy_rational *>(payload()); }
 #ifndef PMP_DISABLE_VECTOR
-                , m_vector(NULL)
+                  vector_type&   vector()         { return *static_cast<vector_type *>(payload()); }
+            const vector_type&   vector()   const { return *static_cast<const vector_type *>(payload()); }
 #endif
-            {
-            }
 
-            Inner(int num, int denom) :
-                m_type(RATIONAL),
-                m_integer(NULL),
-                m_floating(NULL),
-                m_rational(new rational_type(num, denom))
-#ifndef PMP_DISABLE_VECTOR
-                , m_vector(NULL)
-#endif
+            template <typename T>
+            static Inner *create(Type type)
             {
+                Inner *inner = allocate(type, sizeof(T));
+                try
+                {
+                    new(inner->payload()) T();
+                }
+                catch (...)
+                {
+                    deallocate(inner);
+                    throw;
+                }
+                return inner->created();
             }
 
-            explicit Inner(__int64 num, __int64 denom) :
-                m_type(RATIONAL),
-                m_integer(NULL),
-                m_floating(NULL),
-                m_rational(new rational_type(num, denom))
-#ifndef PMP_DISABLE_VECTOR
-                , m_vector(NULL)
-#endif
+            template <typename T, typename A1>
+            static Inner *create(Type type, const A1& a1)
             {
+                Inner *inner = allocate(type, sizeof(T));
+                try
+                {
+                    new(inner->payload()) T(a1);
+                }
+                catch (...)
+                {
+                    deallocate(inner);
+                    throw;
+                }
+                return inner->created();
             }
 
-            explicit Inner(long double f) :
-                m_type(FLOATING),
-                m_integer(NULL),
-                m_floating(new floating_type(f)),
-                m_rational(NULL)
-#ifndef PMP_DISABLE_VECTOR
-                , m_vector(NULL)
-#endif
+            template <typename T, typename A1, typename A2>
+            static Inner *create(Type type, const A1& a1, const A2& a2)
             {
+                Inner *inner = allocate(type, sizeof(T));
+                try
+                {
+                    new(inner->payload()) T(a1, a2);
+                }
+                catch (...)
+                {
+                    deallocate(inner);
+                    throw;
+                }
+                return inner->created();
             }
 
-            Inner(const integer_type& i) :
-                m_type(INTEGER),
-                m_integer(new integer_type(i)),
-                m_floating(NULL),
-                m_rational(NULL)
-#ifndef PMP_DISABLE_VECTOR
-                , m_vector(NULL)
-#endif
+            static Inner *create_lazy(const lazy_rational& q)
             {
+                Inner *inner = allocate(RATIONAL, sizeof(lazy_rational));
+                try
+                {
+                    new(inner->payload()) lazy_rational(q);
+                }
+                catch (...)
+                {
+                    deallocate(inner);
+                    throw;
+                }
+                inner->m_lazy = true;
+                return inner;
             }
 
-            Inner(const floating_type& f) :
-                m_type(FLOATING),
-                m_integer(NULL),
-                m_floating(new floating_type(f)),
-                m_rational(NULL)
-#ifndef PMP_DISABLE_VECTOR
-                , m_vector(NULL)
-#endif
-            {
-            }
+            static Inner *parse(Type type, const std::string& str);
+            static Inner *parse(const std::string& str);
 
-            Inner(const rational_type& r) :
-                m_type(RATIONAL),
-                m_integer(NULL),
-                m_floating(NULL),
-                m_rational(new rational_type(r))
-#ifndef PMP_DISABLE_VECTOR
-                , m_vector(NULL)
-#endif
+            static Inner *copy(const Inner& inner)
             {
-            }
+                switch (inner.m_type)
+                {
+                case INTEGER:
+                    return create<integer_type>(INTEGER, inner.integer());
+
+                case FLOATING:
+                    return create<floating_type>(FLOATING, inner.floating());
+
+                case RATIONAL:
+                    if (inner.m_lazy && inner.m_rational.load() == NULL)
+                        return create_lazy(inner.lazy());
+                    return create<rational_type>(RATIONAL, inner.rational());
 
-            Inner(const Inner& inner) :
-                m_type(inner.m_type),
-                m_integer(NULL),
-                m_floating(NULL),
-                m_rational(NULL)
-#ifndef PMP_DISABLE_VECTOR
-                , m_vector(NULL)
-#endif
-            {
-                m_integer = (inner.m_integer
-                              ? new integer_type(*inner.m_integer)
-                              : NULL);
-                m_floating = (inner.m_floating
-                              ? new floating_type(*inner.m_floating)
-                              : NULL);
-                m_rational = (inner.m_rational
-                              ? new rational_type(*inner.m_rational)
-                              : NULL);
 #ifndef PMP_DISABLE_VECTOR
-                m_vector = (inner.m_vector
-                            ? new vector_type(*inner.m_vector)
-                            : NULL);
+                case VECTOR:
+                    return create<vector_type>(VECTOR, inner.vector());
 #endif
+
+                default:
+                    assert(0);
+                    return NULL;
+                }
             }
 
-            Inner(Type type, const std::string& str) :
-                m_type(type),
-                m_integer(NULL),
-                m_floating(NULL),
-                m_rational(NULL)
-#ifndef PMP_DISABLE_VECTOR
-                , m_vector(NULL)
-#endif
+            static void destroy(Inner *inner)
             {
-                switch (type)
+                switch (inner->m_type)
                 {
                 case INTEGER:
-                    m_integer = new integer_type(str);
+                    inner->integer().~integer_type();
                     break;
 
                 case FLOATING:
-                    m_floating = new floating_type(str);
+                    inner->floating().~floating_type();
                     break;
 
                 case RATIONAL:
-                    m_rational = new rational_type(str);
+                    if (inner->m_lazy)
+                    {
+                        inner->lazy().~lazy_rational();
+                        PMP_DELETE(inner->m_rational.load());
+                    }
+                    else
+                    {
+                        inner->m_rational.load()->~rational_type();
+                    }
                     break;
 
 #ifndef PMP_DISABLE_VECTOR
                 case VECTOR:
-                    {
-                        std::vector<std::string> strs;
-                        pmp::split(str, ',', strs);
-                        m_vector = new vector_type;
-                        for (size_t i = 0; i < strs.size(); ++i)
-                            m_vector->push_back(Number(strs[i]));
-                    }
+                    inner->vector().~vector_type();
                     break;
 #endif
 
@@ -620,81 +974,218 @@ namespace pmp
                     assert(0);
                     break;
                 }
+                deallocate(inner);
             }
 
-            Inner(const std::string& str) :
-                m_type(INTEGER),
-                m_integer(NULL),
-                m_floating(NULL),
-                m_rational(NULL)
-#ifndef PMP_DISABLE_VECTOR
-                , m_vector(NULL)
-#endif
+            const rational_type& rational() const
             {
-#ifndef PMP_DISABLE_VECTOR
-                if (str.find(',') != std::string::npos)
+                rational_type *r = m_rational.load(std::memory_order_acquire);
+                if (r == NULL)
                 {
-                    m_type = VECTOR;
-                    std::vector<std::string> strs;
-                    pmp::split(str, ',', strs);
-                    m_vector = new vector_type;
-                    for (size_t i = 0; i < strs.size(); ++i)
-                        m_vector->push_back(Number(strs[i]));
-                }
-                else
-#endif
-                if (str.find('.') != std::string::npos ||
-                    str.find("e+") != std::string::npos ||
-                    str.find("e-") != std::string::npos)
-                {
-                    m_type = FLOATING;
-                    m_floating = new floating_type(str);
+                    // reduce once; a thread that loses the race uses the
+                    // winner's value
+                    // the Inner may outlive the current arena
+                    Arena::Suspend suspend;
+                    assert(m_lazy);
+                    rational_type *reduced = PMP_NEW rational_type(lazy().normalized());
+                    if (m_rational.compare_exchange_strong(r, reduced,
+                                                           std::memory_order_acq_rel))
+                    {
+                        r = reduced;
+                    }
+                    else
+                    {
+                        PMP_DELETE(reduced);
+                    }
                 }
-                else if (str.find('/') != std::string::npos)
+                return *r;
+            }
+
+            // interned Inners are shared by all threads and never freed,
+            // so they are not counted
+            friend void intrusive_ptr_add_ref(const Inner *inner)
+            {
+                if (!inner->m_interned)
                 {
-                    m_type = RATIONAL;
-                    m_rational = new rational_type(str);
+#ifdef PMP_SINGLE_THREADED
+                    ++inner->m_refs;
+#else
+                    inner->m_refs.fetch_add(1, std::memory_order_relaxed);
+#endif
                 }
-                else
+            }
+
+            friend void intrusive_ptr_release(const Inner *inner)
+            {
+                if (inner->m_interned)
+                    return;
+#ifdef PMP_SINGLE_THREADED
+                if (--inner->m_refs == 0)
+#else
+                if (inner->m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+#endif
                 {
-                    m_integer = new integer_type(str);
+                    destroy(const_cast<Inner *>(inner));
                 }
             }
 
-            Inner(const integer_type& num, const integer_type& denom) :
-                m_type(RATIONAL),
-                m_integer(NULL),
-                m_floating(NULL),
-                m_rational(new rational_type(num, denom))
-#ifndef PMP_DISABLE_VECTOR
-                , m_vector(NULL)
-#endif
+        protected:
+            explicit Inner(Type type) :
+                m_type(type),
+                m_lazy(false),
+                m_interned(false),
+                m_refs(0),
+                m_hash(0),
+                m_rational(NULL)
             {
             }
 
-#ifndef PMP_DISABLE_VECTOR
-            Inner(const vector_type& vec) :
-                m_type(VECTOR),
-                m_integer(NULL),
-                m_floating(NULL),
-                m_rational(NULL),
-                m_vector(new vector_type(vec))
+            static Inner *allocate(Type type, size_t payload_size)
             {
+                return new(PMP_ALLOCATE(header_size() + payload_size)) Inner(type);
             }
-#endif
 
-            ~Inner()
+            static void deallocate(Inner *inner)
             {
-                delete m_integer;
-                delete m_floating;
-                delete m_rational;
-#ifndef PMP_DISABLE_VECTOR
-                delete m_vector;
-#endif
+                inner->~Inner();
+                PMP_DEALLOCATE(inner);
             }
+
+            Inner *created()
+            {
+                if (m_type == RATIONAL)
+                    m_rational = static_cast<rational_type *>(payload());
+                return this;
+            }
+
+        private:
+            Inner(const Inner&);
+            Inner& operator=(const Inner&);
         }; // struct Inner
 
-        boost::shared_ptr<Inner> m_inner;
+        boost::intrusive_ptr<Inner> m_inner;
+
+        // Small integers, 0.0 and 1.0 share preallocated Inners that are
+        // never modified; the non-const accessors unshare() them first.
+        static const int s_interned_min = -16;
+        static const int s_interned_max = 256;
+        static std::atomic<Inner * const *> s_interned;
+        static Inner * const *interned();
+
+        static boost::intrusive_ptr<Inner> make_inner(int i)
+        {
+            if (s_interned_min <= i && i <= s_interned_max)
+                return interned()[i - s_interned_min];
+            return new_inner(i);
+        }
+
+        static boost::intrusive_ptr<Inner> make_inner(__int64 i)
+        {
+            if (s_interned_min <= i && i <= s_interned_max)
+                return interned()[static_cast<int>(i) - s_interned_min];
+            return new_inner(i);
+        }
+
+        static boost::intrusive_ptr<Inner> make_inner(double f)
+        {
+            const int count = s_interned_max - s_interned_min + 1;
+            if (f == 1.0)
+                return interned()[count + 1];
+            if (f == 0.0 && !std::signbit(f))
+                return interned()[count];
+            return new_inner(f);
+        }
+
+        static boost::intrusive_ptr<Inner> new_inner(int i)
+        {
+            return Inner::create<integer_type>(INTEGER, i);
+        }
+
+        static boost::intrusive_ptr<Inner> new_inner(__int64 i)
+        {
+            return Inner::create<integer_type>(INTEGER, i);
+        }
+
+        static boost::intrusive_ptr<Inner> new_inner(double f)
+        {
+            return Inner::create<floating_type>(FLOATING, f);
+        }
+
+        static boost::intrusive_ptr<Inner> new_inner(long double f)
+        {
+            return Inner::create<floating_type>(FLOATING, f);
+        }
+
+        static boost::intrusive_ptr<Inner> new_inner(const integer_type& i)
+        {
+            return Inner::create<integer_type>(INTEGER, i);
+        }
+
+        static boost::intrusive_ptr<Inner> new_inner(const floating_type& f)
+        {
+            return Inner::create<floating_type>(FLOATING, f);
+        }
+
+        static boost::intrusive_ptr<Inner> new_inner(const rational_type& r)
+        {
+            return Inner::create<rational_type>(RATIONAL, r);
+        }
+
+        static boost::intrusive_ptr<Inner> new_inner(int num, int denom)
+        {
+            return Inner::create<rational_type>(RATIONAL, num, denom);
+        }
+
+        static boost::intrusive_ptr<Inner> new_inner(__int64 num, __int64 denom)
+        {
+            return Inner::create<rational_type>(RATIONAL, num, denom);
+        }
+
+        static boost::intrusive_ptr<Inner>
+        new_inner(const integer_type& num, const integer_type& denom)
+        {
+            return Inner::create<rational_type>(RATIONAL, num, denom);
+        }
+
+        static boost::intrusive_ptr<Inner> new_inner(const lazy_rational& q)
+        {
+            return Inner::create_lazy(q);
+        }
+
+#ifndef PMP_DISABLE_VECTOR
+        static boost::intrusive_ptr<Inner> new_inner(const vector_type& vec)
+        {
+            return Inner::create<vector_type>(VECTOR, vec);
+        }
+#endif
+
+        static boost::intrusive_ptr<Inner> new_inner(const std::string& str)
+        {
+            return Inner::parse(str);
+        }
+
+        static boost::intrusive_ptr<Inner> new_inner(Type type, const std::string& str)
+        {
+            return Inner::parse(type, str);
+        }
+
+        static boost::intrusive_ptr<Inner> new_inner(const Inner& inner)
+        {
+            return Inner::copy(inner);
+        }
+
+        void unshare()
+        {
+            if (m_inner->m_interned)
+                m_inner = new_inner(*m_inner);
+        }
+
+        bool lazy_operands(const Number& num) const;
+        void assign_lazy(const lazy_rational& q);
+
+        void serialize_value(std::string& out) const;
+        const char *deserialize_value(const char *p, const char *last,
+                                      unsigned depth);
     }; // class Number
 
     #ifdef PMP_INTDIV_INTEGER
@@ -704,19 +1195,29 @@ namespace pmp
         Number::Type SetIntDivType(Number::Type type);
     #endif
 
+    // Lazy rationals: rational add, sub, mul and div skip the gcd until a
+    // numerator or denominator grows beyond the threshold (in bits), or the
+    // value is compared, printed or normalize()d.
+    bool SetLazyRational(bool enable);
+    size_t SetLazyRationalThreshold(size_t bits);
+
+    // Auto demotion: the arithmetic operators demote() their result, so
+    // later math stays on integers where the value allows it.
+    bool SetAutoDemote(bool enable);
+
     template <typename T>
     inline T Number::convert_to()
     {
         switch (type())
         {
         case INTEGER:
-            return m_inner->m_integer->convert_to<T>();
+            return m_inner->integer().convert_to<T>();
 
         case FLOATING:
-            return m_inner->m_floating->convert_to<T>();
+            return m_inner->floating().convert_to<T>();
 
         case RATIONAL:
-            return m_inner->m_rational->convert_to<T>();
+            return get_r().convert_to<T>();
 
         default:
             assert(0);
@@ -737,7 +1238,7 @@ operator<<(std::basic_ostream<CharT>& o, const pmp::Number& num)
     switch (num.type())
     {
     case pmp::Number::INTEGER:
-        o << num.get_i().str();
+        o << pmp::i_to_str(num.get_i());
         break;
 
     case pmp::Number::FLOATING:
@@ -771,9 +1272,71 @@ operator<<(std::basic_ostream<CharT>& o, const pmp::Number& num)
 
 namespace pmp
 {
+    // Out-parameter arithmetic: out = a + b, a - b, a * b, a / b and
+    // a * b + c.  The result is written into out's own storage when out
+    // already holds the result's type and is not shared; otherwise out
+    // gets a new value as with the operators.  out may be an operand.
+    // Under SetAutoDemote the result is demoted as the operators do.
+    void add(Number& out, const Number& a, const Number& b);
+    void sub(Number& out, const Number& a, const Number& b);
+    void mul(Number& out, const Number& a, const Number& b);
+    void div(Number& out, const Number& a, const Number& b);
+    void fma(Number& out, const Number& a, const Number& b, const Number& c);
+
+    // q = a / b truncated toward zero and r = a - q * b.  q is an integer
+    // unless a or b is floating, and then it is an integral floating.
+    void divmod(Number& q, Number& r, const Number& a, const Number& b);
+
     Number abs(const Number& num1);
     Number fabs(const Number& num1);
 
+    // Native arrays.  to_doubles and to_int64s write the first n elements
+    // of num (a scalar counts as a vector of one) to out and return how
+    // many they wrote.  Doubles are what convert_to<double>() gives.
+    // Int64s are truncated toward zero; values outside the range of
+    // __int64 are clamped to it, and NaN gives 0, each counted in
+    // *overflows if given.
+    size_t to_doubles(const Number& num, double *out, size_t n);
+    size_t to_int64s(const Number& num, __int64 *out, size_t n,
+                     size_t *overflows = NULL);
+#ifndef PMP_DISABLE_VECTOR
+    // a vector of n floatings or integers, as Number(double) and
+    // Number(__int64) would make them
+    Number from_doubles(const double *values, size_t n);
+    Number from_int64s(const __int64 *values, size_t n);
+#endif
+
+    //
+    // memoization of the pure functions below (off by default)
+    //
+    // Results are kept in a sharded LRU cache keyed on the function and
+    // the exact type and value of the arguments.  floating_type has a
+    // fixed precision, so nothing else changes a result.
+    //
+    enum MemoFunction
+    {
+        MEMO_SQRT, MEMO_EXP, MEMO_LOG, MEMO_LOG10, MEMO_COS, MEMO_SIN,
+        MEMO_TAN, MEMO_ACOS, MEMO_ASIN, MEMO_ATAN, MEMO_COSH, MEMO_SINH,
+        MEMO_TANH, MEMO_POW, MEMO_ATAN2
+    };
+
+    struct MemoStats
+    {
+        size_t hits;
+        size_t misses;
+        size_t size;
+    };
+
+    bool SetMemoize(bool enable);           // returns the old setting
+    size_t SetMemoizeCapacity(size_t entries);
+    MemoStats GetMemoStats();
+    void ClearMemo();                       // also resets the counters
+
+    bool memo_lookup(MemoFunction fn, const Number& num1, const Number *num2,
+                     Number& result);
+    const Number& memo_store(MemoFunction fn, const Number& num1,
+                             const Number *num2, const Number& result);
+
     inline Number sqrt(const Number& num1)
     {
 #ifndef PMP_DISABLE_VECTOR
@@ -785,26 +1348,66 @@ namespace pmp
             return Number(vec);
         }
 #endif
+        Number result;
+        if (pmp::memo_lookup(MEMO_SQRT, num1, NULL, result))
+            return result;
         floating_type f = b_mp::sqrt(num1.to_f());
-        return Number(f);
+        return pmp::memo_store(MEMO_SQRT, num1, NULL, Number(f));
     }
 
     Number floor(const Number& num1);
     Number ceil(const Number& num1);
 
+    //
+    // pmp::Summation --- keeps integer, rational and floating partial sums
+    // apart and combines them once, so that the accumulator is not
+    // promoted on every addition.
+    //
+    class Summation
+    {
+    public:
+        Summation();
+
+        void add(const Number& num);    // vectors are flattened
+        size_t count() const { return m_count; }
+
+        Number result() const;          // same type as a left-to-right sum
+        Number average() const;         // floating
+
+    protected:
+        integer_type    m_integer;
+        integer_type    m_numerator;    // rational partial sum over
+        integer_type    m_denominator;  // a common denominator
+        floating_type   m_floating;
+        bool            m_has_rational;
+        bool            m_has_floating;
+        size_t          m_count;
+
+        void add_rational(const integer_type& num, const integer_type& denom);
+    };
+
+    // batch evaluation; out gets one result per value (and may be values
+    // itself).  Tables and constants are shared across the batch.
+    void exp_batch(const vector_type& values, vector_type& out, unsigned num_threads = 1);
+    void log_batch(const vector_type& values, vector_type& out, unsigned num_threads = 1);
+    void sin_batch(const vector_type& values, vector_type& out, unsigned num_threads = 1);
+    void cos_batch(const vector_type& values, vector_type& out, unsigned num_threads = 1);
+
     inline Number exp(const Number& num1)
     {
 #ifndef PMP_DISABLE_VECTOR
         if (num1.is_v())
         {
             vector_type vec;
-            for (size_t i = 0; i < num1.size(); ++i)
-                vec.push_back(pmp::exp(num1[i]));
+            pmp::exp_batch(num1.get_v(), vec);
             return Number(vec);
         }
 #endif
-        floating_type f = b_mp::exp(num1.to_f());
-        return Number(f);
+        Number result;
+        if (pmp::memo_lookup(MEMO_EXP, num1, NULL, result))
+            return result;
+        floating_type f = pmp::f_exp(num1.to_f());
+        return pmp::memo_store(MEMO_EXP, num1, NULL, Number(f));
     }
 
     inline Number log(const Number& num1)
@@ -813,13 +1416,15 @@ namespace pmp
         if (num1.is_v())
         {
             vector_type vec;
-            for (size_t i = 0; i < num1.size(); ++i)
-                vec.push_back(pmp::log(num1[i]));
+            pmp::log_batch(num1.get_v(), vec);
             return Number(vec);
         }
 #endif
-        floating_type f = b_mp::log(num1.to_f());
-        return Number(f);
+        Number result;
+        if (pmp::memo_lookup(MEMO_LOG, num1, NULL, result))
+            return result;
+        floating_type f = pmp::f_log(num1.to_f());
+        return pmp::memo_store(MEMO_LOG, num1, NULL, Number(f));
     }
 
     inline Number log10(const Number& num1)
@@ -833,8 +1438,11 @@ namespace pmp
             return Number(vec);
         }
 #endif
-        floating_type f = b_mp::log10(num1.to_f());
-        return Number(f);
+        Number result;
+        if (pmp::memo_lookup(MEMO_LOG10, num1, NULL, result))
+            return result;
+        floating_type f = pmp::f_log10(num1.to_f());
+        return pmp::memo_store(MEMO_LOG10, num1, NULL, Number(f));
     }
 
     inline Number cos(const Number& num1)
@@ -843,13 +1451,15 @@ namespace pmp
         if (num1.is_v())
         {
             vector_type vec;
-            for (size_t i = 0; i < num1.size(); ++i)
-                vec.push_back(pmp::cos(num1[i]));
+            pmp::cos_batch(num1.get_v(), vec);
             return Number(vec);
         }
 #endif
-        floating_type f = b_mp::cos(num1.to_f());
-        return Number(f);
+        Number result;
+        if (pmp::memo_lookup(MEMO_COS, num1, NULL, result))
+            return result;
+        floating_type f = pmp::f_cos(num1.to_f());
+        return pmp::memo_store(MEMO_COS, num1, NULL, Number(f));
     }
 
     inline Number sin(const Number& num1)
@@ -858,13 +1468,15 @@ namespace pmp
         if (num1.is_v())
         {
             vector_type vec;
-            for (size_t i = 0; i < num1.size(); ++i)
-                vec.push_back(pmp::sin(num1[i]));
+            pmp::sin_batch(num1.get_v(), vec);
             return Number(vec);
         }
 #endif
-        floating_type f = b_mp::sin(num1.to_f());
-        return Number(f);
+        Number result;
+        if (pmp::memo_lookup(MEMO_SIN, num1, NULL, result))
+            return result;
+        floating_type f = pmp::f_sin(num1.to_f());
+        return pmp::memo_store(MEMO_SIN, num1, NULL, Number(f));
     }
 
     inline Number tan(const Number& num1)
@@ -878,8 +1490,11 @@ namespace pmp
             return Number(vec);
         }
 #endif
-        floating_type f = b_mp::tan(num1.to_f());
-        return Number(f);
+        Number result;
+        if (pmp::memo_lookup(MEMO_TAN, num1, NULL, result))
+            return result;
+        floating_type f = pmp::f_tan(num1.to_f());
+        return pmp::memo_store(MEMO_TAN, num1, NULL, Number(f));
     }
 
     inline Number acos(const Number& num1)
@@ -893,8 +1508,11 @@ namespace pmp
             return Number(vec);
         }
 #endif
+        Number result;
+        if (pmp::memo_lookup(MEMO_ACOS, num1, NULL, result))
+            return result;
         floating_type f = b_mp::acos(num1.to_f());
-        return Number(f);
+        return pmp::memo_store(MEMO_ACOS, num1, NULL, Number(f));
     }
 
     inline Number asin(const Number& num1)
@@ -908,8 +1526,11 @@ namespace pmp
             return Number(vec);
         }
 #endif
+        Number result;
+        if (pmp::memo_lookup(MEMO_ASIN, num1, NULL, result))
+            return result;
         floating_type f = b_mp::asin(num1.to_f());
-        return Number(f);
+        return pmp::memo_store(MEMO_ASIN, num1, NULL, Number(f));
     }
 
     inline Number atan(const Number& num1)
@@ -923,8 +1544,11 @@ namespace pmp
             return Number(vec);
         }
 #endif
+        Number result;
+        if (pmp::memo_lookup(MEMO_ATAN, num1, NULL, result))
+            return result;
         floating_type f = b_mp::atan(num1.to_f());
-        return Number(f);
+        return pmp::memo_store(MEMO_ATAN, num1, NULL, Number(f));
     }
 
     inline Number cosh(const Number& num1)
@@ -938,8 +1562,11 @@ namespace pmp
             return Number(vec);
         }
 #endif
+        Number result;
+        if (pmp::memo_lookup(MEMO_COSH, num1, NULL, result))
+            return result;
         floating_type f = b_mp::cosh(num1.to_f());
-        return Number(f);
+        return pmp::memo_store(MEMO_COSH, num1, NULL, Number(f));
     }
 
     inline Number sinh(const Number& num1)
@@ -953,8 +1580,11 @@ namespace pmp
             return Number(vec);
         }
 #endif
+        Number result;
+        if (pmp::memo_lookup(MEMO_SINH, num1, NULL, result))
+            return result;
         floating_type f = b_mp::sinh(num1.to_f());
-        return Number(f);
+        return pmp::memo_store(MEMO_SINH, num1, NULL, Number(f));
     }
 
     inline Number tanh(const Number& num1)
@@ -968,10 +1598,17 @@ namespace pmp
             return Number(vec);
         }
 #endif
+        Number result;
+        if (pmp::memo_lookup(MEMO_TANH, num1, NULL, result))
+            return result;
         floating_type f = b_mp::tanh(num1.to_f());
-        return Number(f);
+        return pmp::memo_store(MEMO_TANH, num1, NULL, Number(f));
     }
 
+    // integer or rational base, integer exponent; exact where it can be,
+    // floating when the exact result would pass 2^24 bits
+    Number pow_exact(const Number& num1, const integer_type& e);
+
     inline Number pow(const Number& num1, const Number& num2)
     {
 #ifndef PMP_DISABLE_VECTOR
@@ -984,8 +1621,17 @@ namespace pmp
             return Number(vec);
         }
 #endif
+        Number result;
+        if (pmp::memo_lookup(MEMO_POW, num1, &num2, result))
+            return result;
+        if ((num1.is_i() || num1.is_r()) &&
+            (num2.is_i() || (num2.is_r() && b_mp::denominator(num2.get_r()) == 1)))
+        {
+            return pmp::memo_store(MEMO_POW, num1, &num2,
+                                   pmp::pow_exact(num1, num2.to_i()));
+        }
         floating_type f = b_mp::pow(num1.to_f(), num2.to_f());
-        return Number(f);
+        return pmp::memo_store(MEMO_POW, num1, &num2, Number(f));
     }
 
     inline Number fmod(const Number& num1, const Number& num2)
@@ -1016,8 +1662,11 @@ namespace pmp
             return Number(vec);
         }
 #endif
+        Number result;
+        if (pmp::memo_lookup(MEMO_ATAN2, num1, &num2, result))
+            return result;
         floating_type f = b_mp::atan2(num1.to_f(), num2.to_f());
-        return Number(f);
+        return pmp::memo_store(MEMO_ATAN2, num1, &num2, Number(f));
     }
 
     inline Number numerator(const Number& num1)
@@ -1073,31 +1722,39 @@ namespace pmp
     inline Number sum(const Number& num1)
     {
 #ifndef PMP_DISABLE_VECTOR
-        Number n(0);
         if (num1.is_v())
         {
-            for (size_t i = 0; i < num1.size(); ++i)
-            {
-                n += pmp::sum(num1[i]);
-            }
-            return n;
+            Summation s;
+            s.add(num1);
+            return s.result();
         }
 #endif
         return num1;
     }
 
+    // balanced product of vec[first, last).
+    // Subtrees are evaluated on up to num_threads threads.
+    Number product_tree(const vector_type& vec, size_t first, size_t last,
+                        unsigned num_threads = 1);
+
+    inline Number product_tree(const vector_type& vec, unsigned num_threads = 1)
+    {
+        return product_tree(vec, 0, vec.size(), num_threads);
+    }
+
     // product
     inline Number prod(const Number& num1)
     {
 #ifndef PMP_DISABLE_VECTOR
-        Number n(1);
         if (num1.is_v())
         {
+            vector_type vec;
+            vec.reserve(num1.size());
             for (size_t i = 0; i < num1.size(); ++i)
             {
-                n *= pmp::prod(num1[i]);
+                vec.push_back(pmp::prod(num1[i]));
             }
-            return n;
+            return pmp::product_tree(vec);
         }
 #endif
         return num1;
@@ -1141,10 +1798,9 @@ namespace pmp
 
     inline Number average(const Number& num1)
     {
-        Number n = pmp::sum(num1);
-        n += 0.0;
-        n /= pmp::count(num1);
-        return n;
+        Summation s;
+        s.add(num1);
+        return s.average();
     }
 
     #undef max
@@ -1182,6 +1838,85 @@ namespace pmp
 #endif
         return num1;
     }
+
+    //
+    // pmp::ModContext --- arithmetic modulo a fixed positive modulus.
+    // Odd moduli use Montgomery multiplication on the limbs, even moduli
+    // use Barrett reduction.  All members are const, so one context can be
+    // shared between threads.
+    //
+    class ModContext
+    {
+    public:
+        explicit ModContext(const integer_type& modulus);
+        explicit ModContext(const Number& modulus);
+
+        const integer_type& modulus() const { return m_modulus; }
+
+        integer_type reduce(const integer_type& a) const;   // into [0, m)
+        integer_type mulmod(const integer_type& a, const integer_type& b) const;
+        integer_type powmod(const integer_type& base, const integer_type& e) const;
+        bool invmod(integer_type& result, const integer_type& a) const;
+
+        // element-wise on vectors; invmod throws std::domain_error if an
+        // element has no inverse
+        Number mulmod(const Number& a, const Number& b) const;
+        Number powmod(const Number& base, const Number& e) const;
+        Number invmod(const Number& a) const;
+        vector_type invmod(const vector_type& values) const;  // Montgomery's trick
+
+    protected:
+        typedef std::vector<b_mp::limb_type> limbs_type;
+
+        integer_type    m_modulus;
+        size_t          m_bits;
+        bool            m_montgomery;
+        limbs_type      m_limbs;        // modulus
+        b_mp::limb_type m_inv;          // -1/m mod 2^limb_bits
+        limbs_type      m_r2;           // R^2 mod m
+        limbs_type      m_one;          // R mod m
+        integer_type    m_mu;           // Barrett reciprocal
+
+        void init();
+        void to_limbs(limbs_type& out, const integer_type& a) const;
+        void from_limbs(integer_type& out, const limbs_type& a) const;
+        void mont_mul(limbs_type& out, const limbs_type& a, const limbs_type& b,
+                      limbs_type& scratch) const;
+        integer_type barrett(const integer_type& a) const;
+    };
+
+    Number powmod(const Number& base, const Number& e, const Number& m);
+    Number invmod(const Number& a, const Number& m);
+
+    //
+    // integer functions; arguments are converted with to_i() and bad
+    // arguments throw std::domain_error
+    //
+    size_t bit_length(const integer_type& x);   // of |x|; 0 for 0
+    integer_type i_gcd(const integer_type& a, const integer_type& b);
+    integer_type i_lcm(const integer_type& a, const integer_type& b);
+    integer_type i_isqrt(const integer_type& x);                // floor
+    bool i_iroot(integer_type& root, const integer_type& x, unsigned long n);
+                                                    // true if exact
+    bool i_is_prime(const integer_type& n, unsigned rounds = 25);
+
+    Number gcd(const Number& num1, const Number& num2);
+    Number lcm(const Number& num1, const Number& num2);
+    Number isqrt(const Number& num1);
+    Number iroot(const Number& num1, unsigned long n);
+    Number bit_length(const Number& num1);
+    Number ilog2(const Number& num1);                   // floor(log2 |x|)
+    bool is_prime(const Number& num1, unsigned rounds = 25);
+    std::vector<bool> is_prime(const vector_type& values, unsigned rounds = 25,
+                               unsigned num_threads = 1);
+
+    Number constant(ConstantType c);                    // floating
+    Number constant(ConstantType c, size_t digits);     // rational, truncated
+
+    // negative n throws std::domain_error
+    Number factorial(const Number& n);
+    Number binomial(const Number& n, const Number& k);  // 0 unless 0 <= k <= n
+    Number primorial(const Number& n);
 } // namespace pmp
 
 namespace std
@@ -1190,6 +1925,15 @@ namespace std
     {
         num1.swap(num2);
     }
+
+    template <>
+    struct hash<pmp::Number>
+    {
+        size_t operator()(const pmp::Number& num) const
+        {
+            return num.hash();
+        }
+    };
 } // namespace std
 
 /////////////////////////////////////////////////////////////////////////////
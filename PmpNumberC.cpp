@@ -0,0 +1,316 @@
+/////////////////////////////////////////////////////////////////////////////
+// PmpNumberC --- C interface to pmp::Number
+// See file "ReadMe.txt" and "License.txt".
+/////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+#include <cstring>      // for std::strlen, std::memcpy
+
+#if defined(_MSC_VER)
+    #define PMP_THREAD_LOCAL    __declspec(thread)
+#else
+    #define PMP_THREAD_LOCAL    __thread
+#endif
+
+namespace pmp
+{
+    static PMP_THREAD_LOCAL char s_last_error[256];
+
+    static inline Number *from_handle(pmp_number num)
+    {
+        return reinterpret_cast<Number *>(num);
+    }
+
+    static inline pmp_number to_handle(Number *num)
+    {
+        return reinterpret_cast<pmp_number>(num);
+    }
+
+    // counts the failures of one batch call and keeps the first message
+    class BatchErrors
+    {
+    public:
+        BatchErrors(const char *name) : m_name(name), m_count(0)
+        {
+            s_last_error[0] = '\0';
+        }
+
+        void fail(size_t index, const char *what)
+        {
+            if (m_count++ == 0)
+            {
+                std::string msg(m_name);
+                msg += ": element ";
+                msg += std::to_string(static_cast<unsigned long long>(index));
+                msg += ": ";
+                msg += what;
+                size_t len = msg.copy(s_last_error, sizeof(s_last_error) - 1);
+                s_last_error[len] = '\0';
+            }
+        }
+
+        size_t count() const    { return m_count; }
+
+    protected:
+        const char *    m_name;
+        size_t          m_count;
+    };
+
+    // stores value into out, in place if out is a handle already
+    static inline void put(pmp_number& out, const Number& value)
+    {
+        if (out)
+            *from_handle(out) = value;
+        else
+            out = to_handle(new Number(value));
+    }
+
+    typedef void (*binary_function)(Number& out, const Number& a, const Number& b);
+
+    static size_t binary_n(const char *name, binary_function fn,
+                           const pmp_number *a, const pmp_number *b,
+                           size_t n, pmp_number *out)
+    {
+        BatchErrors errors(name);
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (!a[i] || !b[i])
+            {
+                errors.fail(i, "null handle");
+                continue;
+            }
+            try
+            {
+                if (out[i])
+                {
+                    fn(*from_handle(out[i]), *from_handle(a[i]), *from_handle(b[i]));
+                }
+                else
+                {
+                    Number result;
+                    fn(result, *from_handle(a[i]), *from_handle(b[i]));
+                    out[i] = to_handle(new Number(result));
+                }
+            }
+            catch (std::exception& e)
+            {
+                errors.fail(i, e.what());
+            }
+        }
+        return errors.count();
+    }
+} // namespace pmp
+
+using namespace pmp;
+
+extern "C" void pmp_free(pmp_number num)
+{
+    delete from_handle(num);
+}
+
+extern "C" void pmp_free_n(pmp_number *nums, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        delete from_handle(nums[i]);
+        nums[i] = NULL;
+    }
+}
+
+extern "C" const char *pmp_last_error(void)
+{
+    return s_last_error;
+}
+
+extern "C" size_t pmp_parse_n(const char * const *strings, const size_t *lengths,
+                              size_t n, pmp_number *out)
+{
+    BatchErrors errors("pmp_parse_n");
+    for (size_t i = 0; i < n; ++i)
+    {
+        const char *str = strings[i];
+        if (!str)
+        {
+            errors.fail(i, "null string");
+            continue;
+        }
+        try
+        {
+            size_t len = (lengths ? lengths[i] : std::strlen(str));
+            put(out[i], NumberReader::parse(str, str + len));
+        }
+        catch (std::exception& e)
+        {
+            errors.fail(i, e.what());
+        }
+    }
+    return errors.count();
+}
+
+extern "C" size_t pmp_from_int64s(const long long *values, size_t n, pmp_number *out)
+{
+    BatchErrors errors("pmp_from_int64s");
+    for (size_t i = 0; i < n; ++i)
+    {
+        try
+        {
+            put(out[i], Number(static_cast<__int64>(values[i])));
+        }
+        catch (std::exception& e)
+        {
+            errors.fail(i, e.what());
+        }
+    }
+    return errors.count();
+}
+
+extern "C" size_t pmp_from_doubles(const double *values, size_t n, pmp_number *out)
+{
+    BatchErrors errors("pmp_from_doubles");
+#ifndef PMP_DISABLE_VECTOR
+    try
+    {
+        Number vec = from_doubles(values, n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (out[i])
+                from_handle(out[i])->swap(vec.get_v()[i]);
+            else
+                out[i] = to_handle(new Number(vec.get_v()[i]));
+        }
+    }
+    catch (std::exception& e)
+    {
+        errors.fail(0, e.what());
+    }
+#else
+    for (size_t i = 0; i < n; ++i)
+    {
+        try
+        {
+            put(out[i], Number(values[i]));
+        }
+        catch (std::exception& e)
+        {
+            errors.fail(i, e.what());
+        }
+    }
+#endif
+    return errors.count();
+}
+
+extern "C" size_t pmp_to_int64s(const pmp_number *nums, size_t n, long long *out)
+{
+    BatchErrors errors("pmp_to_int64s");
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (!nums[i])
+        {
+            errors.fail(i, "null handle");
+            continue;
+        }
+        try
+        {
+            __int64 value = 0;
+            size_t overflows = 0;
+            if (to_int64s(*from_handle(nums[i]), &value, 1, &overflows) != 1)
+            {
+                errors.fail(i, "empty vector");
+                continue;
+            }
+            out[i] = value;
+            if (overflows)
+                errors.fail(i, "out of the range of int64");
+        }
+        catch (std::exception& e)
+        {
+            errors.fail(i, e.what());
+        }
+    }
+    return errors.count();
+}
+
+extern "C" size_t pmp_to_doubles(const pmp_number *nums, size_t n, double *out)
+{
+    BatchErrors errors("pmp_to_doubles");
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (!nums[i])
+        {
+            errors.fail(i, "null handle");
+            continue;
+        }
+        try
+        {
+            if (to_doubles(*from_handle(nums[i]), &out[i], 1) != 1)
+                errors.fail(i, "empty vector");
+        }
+        catch (std::exception& e)
+        {
+            errors.fail(i, e.what());
+        }
+    }
+    return errors.count();
+}
+
+extern "C" size_t pmp_add_n(const pmp_number *a, const pmp_number *b, size_t n, pmp_number *out)
+{
+    return binary_n("pmp_add_n", pmp::add, a, b, n, out);
+}
+
+extern "C" size_t pmp_sub_n(const pmp_number *a, const pmp_number *b, size_t n, pmp_number *out)
+{
+    return binary_n("pmp_sub_n", pmp::sub, a, b, n, out);
+}
+
+extern "C" size_t pmp_mul_n(const pmp_number *a, const pmp_number *b, size_t n, pmp_number *out)
+{
+    return binary_n("pmp_mul_n", pmp::mul, a, b, n, out);
+}
+
+extern "C" size_t pmp_div_n(const pmp_number *a, const pmp_number *b, size_t n, pmp_number *out)
+{
+    return binary_n("pmp_div_n", pmp::div, a, b, n, out);
+}
+
+extern "C" size_t pmp_format_n(const pmp_number *nums, size_t n, char sep,
+                               char *buf, size_t size, size_t *offsets)
+{
+    BatchErrors errors("pmp_format_n");
+    std::string text;
+    size_t len = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        text.clear();
+        if (!nums[i])
+        {
+            errors.fail(i, "null handle");
+        }
+        else
+        {
+            try
+            {
+                text = from_handle(nums[i])->str();
+            }
+            catch (std::exception& e)
+            {
+                errors.fail(i, e.what());
+            }
+        }
+        text += sep;
+
+        if (offsets)
+            offsets[i] = len;
+        if (len + 1 < size)
+        {
+            size_t room = size - 1 - len;
+            std::memcpy(buf + len, text.data(), text.size() < room ? text.size() : room);
+        }
+        len += text.size();
+    }
+    if (offsets)
+        offsets[n] = len;
+    if (size > 0)
+        buf[len < size ? len : size - 1] = '\0';
+    return len;
+}
@@ -0,0 +1,81 @@
+/////////////////////////////////////////////////////////////////////////////
+// PmpNumberC --- C interface to pmp::Number
+// See file "ReadMe.txt" and "License.txt".
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef PMPNUMBERC_H_
+#define PMPNUMBERC_H_
+
+#include <stddef.h>     // for size_t
+
+#if defined(_WIN32)
+    #if defined(PMP_BUILD_DLL)
+        #define PMP_API __declspec(dllexport)
+    #elif defined(PMP_USE_DLL)
+        #define PMP_API __declspec(dllimport)
+    #else
+        #define PMP_API
+    #endif
+#elif defined(__GNUC__)
+    #define PMP_API __attribute__((visibility("default")))
+#else
+    #define PMP_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// A pmp_number is an opaque handle to a pmp::Number.  Handles are made by
+// the functions below and released by pmp_free or pmp_free_n.
+//
+// The batch functions work on arrays of n elements and return how many
+// of them failed; pmp_last_error then describes the first one.  A failed
+// handle in out is left as it was, NULL if it was NULL.  A handle in out
+// that is not NULL is overwritten in place and keeps its address, so out
+// may be one of the operands.  A NULL operand fails.
+//
+typedef struct pmp_number_s *pmp_number;
+
+PMP_API void pmp_free(pmp_number num);
+PMP_API void pmp_free_n(pmp_number *nums, size_t n);
+
+// the first failure of the last batch call on this thread, or ""
+PMP_API const char *pmp_last_error(void);
+
+// strings[i] is lengths[i] bytes long, or NUL-terminated if lengths is
+// NULL; blanks around the number are skipped
+PMP_API size_t pmp_parse_n(const char * const *strings, const size_t *lengths,
+                           size_t n, pmp_number *out);
+
+PMP_API size_t pmp_from_int64s(const long long *values, size_t n, pmp_number *out);
+PMP_API size_t pmp_from_doubles(const double *values, size_t n, pmp_number *out);
+
+// as pmp::to_int64s and pmp::to_doubles, one value per handle; a value
+// clamped to the range of int64 is written and counted as a failure
+PMP_API size_t pmp_to_int64s(const pmp_number *nums, size_t n, long long *out);
+PMP_API size_t pmp_to_doubles(const pmp_number *nums, size_t n, double *out);
+
+// out[i] = a[i] op b[i]
+PMP_API size_t pmp_add_n(const pmp_number *a, const pmp_number *b, size_t n, pmp_number *out);
+PMP_API size_t pmp_sub_n(const pmp_number *a, const pmp_number *b, size_t n, pmp_number *out);
+PMP_API size_t pmp_mul_n(const pmp_number *a, const pmp_number *b, size_t n, pmp_number *out);
+PMP_API size_t pmp_div_n(const pmp_number *a, const pmp_number *b, size_t n, pmp_number *out);
+
+// Writes the text of the n numbers into buf, each followed by sep, and
+// a NUL.  Returns the length the whole text needs without the NUL, as
+// snprintf does; if that is size or more, buf holds as much as fits.
+// offsets, if not NULL, gets n + 1 entries: where each number starts,
+// and the full length.  A NULL handle gives empty text and sets
+// pmp_last_error.
+PMP_API size_t pmp_format_n(const pmp_number *nums, size_t n, char sep,
+                            char *buf, size_t size, size_t *offsets);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+
+#endif  // ndef PMPNUMBERC_H_
@@ -0,0 +1,380 @@
+/////////////////////////////////////////////////////////////////////////////
+// NumberReader --- parallel reader of numeric text files
+// See file "ReadMe.txt" and "License.txt".
+/////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+#include <future>       // for std::async
+#include <fstream>      // for std::ifstream
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+namespace pmp
+{
+    //
+    // MappedFile
+    //
+
+    MappedFile::MappedFile() : m_data(NULL), m_size(0)
+#ifdef _WIN32
+        , m_file(INVALID_HANDLE_VALUE), m_mapping(NULL)
+#endif
+    {
+    }
+
+    MappedFile::MappedFile(const std::string& path) : m_data(NULL), m_size(0)
+#ifdef _WIN32
+        , m_file(INVALID_HANDLE_VALUE), m_mapping(NULL)
+#endif
+    {
+        open(path);
+    }
+
+    MappedFile::~MappedFile()
+    {
+        close();
+    }
+
+#ifdef _WIN32
+    bool MappedFile::open(const std::string& path)
+    {
+        close();
+        m_file = ::CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                               NULL, OPEN_EXISTING,
+                               FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (m_file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER size;
+        if (!::GetFileSizeEx(m_file, &size) || size.QuadPart == 0 ||
+            static_cast<unsigned __int64>(size.QuadPart) > static_cast<size_t>(-1))
+        {
+            close();
+            return false;
+        }
+
+        m_mapping = ::CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (m_mapping == NULL)
+        {
+            close();
+            return false;
+        }
+
+        m_data = static_cast<const char *>(
+            ::MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+        if (m_data == NULL)
+        {
+            close();
+            return false;
+        }
+        m_size = static_cast<size_t>(size.QuadPart);
+        return true;
+    }
+
+    void MappedFile::close()
+    {
+        if (m_data)
+            ::UnmapViewOfFile(m_data);
+        if (m_mapping)
+            ::CloseHandle(m_mapping);
+        if (m_file != INVALID_HANDLE_VALUE)
+            ::CloseHandle(m_file);
+        m_data = NULL;
+        m_size = 0;
+        m_mapping = NULL;
+        m_file = INVALID_HANDLE_VALUE;
+    }
+#else   // ndef _WIN32
+    bool MappedFile::open(const std::string& path)
+    {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd == -1)
+            return false;
+
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size == 0 ||
+            static_cast<unsigned long long>(st.st_size) > static_cast<size_t>(-1))
+        {
+            ::close(fd);
+            return false;
+        }
+
+        size_t size = static_cast<size_t>(st.st_size);
+        void *data = ::mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);    // the mapping keeps the file
+        if (data == MAP_FAILED)
+            return false;
+    #ifdef MADV_SEQUENTIAL
+        ::madvise(data, size, MADV_SEQUENTIAL);
+    #endif
+        m_data = static_cast<const char *>(data);
+        m_size = size;
+        return true;
+    }
+
+    void MappedFile::close()
+    {
+        if (m_data)
+            ::munmap(const_cast<char *>(m_data), m_size);
+        m_data = NULL;
+        m_size = 0;
+    }
+#endif  // ndef _WIN32
+
+    //
+    // NumberReader
+    //
+
+    static inline bool is_separator(char ch)
+    {
+        return ch == ',' || ch == '\n' || ch == '\r';
+    }
+
+    static inline bool is_blank(char ch)
+    {
+        return ch == ' ' || ch == '\t';
+    }
+
+    // parses a trimmed field; buf is scratch space for the slow path
+    static Number parse_field(const char *first, const char *last,
+                              std::string& buf)
+    {
+        const char *p = first;
+        bool neg = false;
+        if (*p == '-' || *p == '+')
+        {
+            neg = (*p == '-');
+            ++p;
+        }
+        const char *digits = p;
+        while (p < last && '0' <= *p && *p <= '9')
+            ++p;
+
+        // a leading 0 makes the text octal for Number(const std::string&)
+        if (p == last && p != digits && (*digits != '0' || p - digits == 1))
+        {
+            // plain decimal integer: 18 digits at a time, no text buffer
+            size_t n = last - digits;
+            size_t len = n % 18 ? n % 18 : 18;
+            __int64 chunk = 0;
+            for (p = digits; p < digits + len; ++p)
+                chunk = chunk * 10 + (*p - '0');
+            if (n <= 18)
+                return Number(neg ? -chunk : chunk);
+
+            integer_type i(chunk);
+            while (p < last)
+            {
+                chunk = 0;
+                for (const char *end = p + 18; p < end; ++p)
+                    chunk = chunk * 10 + (*p - '0');
+                i *= 1000000000000000000LL;
+                i += chunk;
+            }
+            if (neg)
+                i = -i;
+            return Number(i);
+        }
+
+        // the same classification as Number(const std::string&)
+        Number::Type type = Number::INTEGER;
+        for (p = first; p < last; ++p)
+        {
+            if (*p == '.' ||
+                (*p == 'e' && p + 1 < last && (p[1] == '+' || p[1] == '-')))
+            {
+                type = Number::FLOATING;
+                break;
+            }
+            if (*p == '/')
+                type = Number::RATIONAL;
+        }
+        buf.assign(first, last);
+        return Number(type, buf);
+    }
+
+    static void parse_chunk(const char *first, const char *last,
+                            vector_type& out)
+    {
+        std::string buf;
+        while (first < last)
+        {
+            while (first < last && (is_separator(*first) || is_blank(*first)))
+                ++first;
+            const char *end = first;
+            while (end < last && !is_separator(*end))
+                ++end;
+            const char *next = end;
+            while (end > first && is_blank(end[-1]))
+                --end;
+            if (first < end)
+                out.push_back(parse_field(first, end, buf));
+            first = next;
+        }
+    }
+
+    // the end of the field that holds first + size
+    static const char *chunk_end(const char *first, const char *last, size_t size)
+    {
+        if (static_cast<size_t>(last - first) <= size)
+            return last;
+        const char *p = first + size;
+        while (p < last && !is_separator(*p))
+            ++p;
+        return p;
+    }
+
+    NumberReader::NumberReader(unsigned num_threads/* = 1*/,
+                               size_t chunk_size/* = 1 << 20*/) :
+        m_num_threads(num_threads), m_chunk_size(chunk_size)
+    {
+#ifdef PMP_SINGLE_THREADED
+        m_num_threads = 1;  // the reference counts are not atomic
+#endif
+        if (m_num_threads < 1)
+            m_num_threads = 1;
+        if (m_chunk_size < 1)
+            m_chunk_size = 1;
+    }
+
+    /*static*/ Number NumberReader::parse(const char *first, const char *last)
+    {
+        while (first < last && is_blank(*first))
+            ++first;
+        while (last > first && is_blank(last[-1]))
+            --last;
+        if (first == last)
+            throw std::domain_error("pmp::NumberReader::parse: empty field");
+        std::string buf;
+        return parse_field(first, last, buf);
+    }
+
+    // parses up to m_num_threads chunks at once and returns where it stopped
+    const char *NumberReader::parse_round(const char *first, const char *last,
+                                          const batch_callback& callback) const
+    {
+        std::vector<vector_type> batches(m_num_threads);
+        std::vector<const char *> bounds(1, first);
+        for (unsigned k = 0; k < m_num_threads && bounds.back() < last; ++k)
+            bounds.push_back(chunk_end(bounds.back(), last, m_chunk_size));
+
+        std::vector<std::future<void> > tasks;
+        for (size_t k = 1; k + 1 < bounds.size(); ++k)
+        {
+            tasks.push_back(std::async(std::launch::async, parse_chunk,
+                                       bounds[k], bounds[k + 1],
+                                       std::ref(batches[k])));
+        }
+        parse_chunk(bounds[0], bounds[1], batches[0]);
+        for (size_t k = 0; k < tasks.size(); ++k)
+            tasks[k].get();
+
+        for (size_t k = 0; k + 1 < bounds.size(); ++k)
+        {
+            if (!batches[k].empty())
+                callback(batches[k]);
+        }
+        return bounds.back();
+    }
+
+    void NumberReader::read(const char *data, size_t size,
+                            const batch_callback& callback) const
+    {
+        const char *last = data + size;
+        while (data < last)
+            data = parse_round(data, last, callback);
+    }
+
+    void NumberReader::read(std::istream& is, const batch_callback& callback) const
+    {
+        std::vector<char> buf(m_chunk_size * m_num_threads);
+        size_t used = 0;
+        for (;;)
+        {
+            if (used == buf.size())
+                buf.resize(buf.size() * 2);     // a field longer than a round
+            is.read(&buf[used], buf.size() - used);
+            used += static_cast<size_t>(is.gcount());
+            bool eof = !is;
+
+            // hold back the field that may continue in the next block
+            size_t cut = used;
+            if (!eof)
+            {
+                while (cut > 0 && !is_separator(buf[cut - 1]))
+                    --cut;
+            }
+            if (cut > 0)
+                read(&buf[0], cut, callback);
+            if (eof)
+                break;
+            std::copy(buf.begin() + cut, buf.begin() + used, buf.begin());
+            used -= cut;
+        }
+    }
+
+    bool NumberReader::read_file(const std::string& path,
+                                 const batch_callback& callback) const
+    {
+        MappedFile file;
+        if (file.open(path))
+        {
+            read(file.data(), file.size(), callback);
+            return true;
+        }
+
+        // empty, or cannot be mapped
+        std::ifstream fin(path.c_str(), std::ios::in | std::ios::binary);
+        if (!fin)
+            return false;
+        read(fin, callback);
+        return true;
+    }
+
+    struct AppendBatch
+    {
+        vector_type *m_out;
+
+        AppendBatch(vector_type& out) : m_out(&out) { }
+
+        void operator()(vector_type& batch) const
+        {
+            if (m_out->empty())
+            {
+                m_out->swap(batch);
+                return;
+            }
+            // swapping leaves the reference counts alone
+            size_t n = m_out->size();
+            m_out->resize(n + batch.size());
+            for (size_t i = 0; i < batch.size(); ++i)
+                (*m_out)[n + i].swap(batch[i]);
+        }
+    };
+
+    void NumberReader::read(const char *data, size_t size, vector_type& out) const
+    {
+        read(data, size, batch_callback(AppendBatch(out)));
+    }
+
+    void NumberReader::read(std::istream& is, vector_type& out) const
+    {
+        read(is, batch_callback(AppendBatch(out)));
+    }
+
+    bool NumberReader::read_file(const std::string& path, vector_type& out) const
+    {
+        return read_file(path, batch_callback(AppendBatch(out)));
+    }
+} // namespace pmp
@@ -0,0 +1,87 @@
+/////////////////////////////////////////////////////////////////////////////
+// NumberReader --- parallel reader of numeric text files
+// See file "ReadMe.txt" and "License.txt".
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef PMPNUMBERREADER_HPP_
+#define PMPNUMBERREADER_HPP_
+
+#include "PmpNumber.hpp"
+#include <functional>   // for std::function
+
+namespace pmp
+{
+    //
+    // pmp::MappedFile --- a read-only view of a whole file
+    //
+    class MappedFile
+    {
+    public:
+        MappedFile();
+        explicit MappedFile(const std::string& path);
+        ~MappedFile();
+
+        // maps the file; false if it cannot be opened or mapped
+        bool open(const std::string& path);
+        void close();
+
+        bool is_open() const        { return m_data != NULL; }
+        const char *data() const    { return m_data; }
+        size_t size() const         { return m_size; }
+
+    protected:
+        const char *    m_data;
+        size_t          m_size;
+#ifdef _WIN32
+        void *          m_file;
+        void *          m_mapping;
+#endif
+
+    private:
+        MappedFile(const MappedFile&);
+        MappedFile& operator=(const MappedFile&);
+    }; // class MappedFile
+
+    //
+    // pmp::NumberReader
+    //
+    // Reads numbers separated by commas or newlines.  The input is cut into
+    // chunks at separators and the chunks are parsed on num_threads threads;
+    // each chunk becomes one batch, delivered in input order.  Blanks around
+    // a number and empty fields are skipped.  A field that Number cannot
+    // parse throws like the string constructor does.
+    //
+    class NumberReader
+    {
+    public:
+        typedef std::function<void (vector_type& batch)> batch_callback;
+
+        NumberReader(unsigned num_threads = 1, size_t chunk_size = 1 << 20);
+
+        unsigned num_threads() const    { return m_num_threads; }
+        size_t chunk_size() const       { return m_chunk_size; }
+
+        // appends the numbers to out
+        void read(const char *data, size_t size, vector_type& out) const;
+        void read(std::istream& is, vector_type& out) const;
+        bool read_file(const std::string& path, vector_type& out) const;
+
+        // calls back once per batch instead of keeping everything
+        void read(const char *data, size_t size, const batch_callback& callback) const;
+        void read(std::istream& is, const batch_callback& callback) const;
+        bool read_file(const std::string& path, const batch_callback& callback) const;
+
+        static Number parse(const char *first, const char *last);
+
+    protected:
+        unsigned    m_num_threads;
+        size_t      m_chunk_size;
+
+        const char *parse_round(const char *first, const char *last,
+                                const batch_callback& callback) const;
+    }; // class NumberReader
+} // namespace pmp
+
+/////////////////////////////////////////////////////////////////////////////
+
+#endif  // ndef PMPNUMBERREADER_HPP_
@@ -0,0 +1,349 @@
+/////////////////////////////////////////////////////////////////////////////
+// NumberStore --- memory-mapped columnar store of numbers
+// See file "ReadMe.txt" and "License.txt".
+/////////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+#include <cstring>      // for std::memcmp
+#include <fstream>      // for std::ofstream
+#include <limits>       // for std::numeric_limits
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <unistd.h>     // for truncate
+#endif
+
+namespace pmp
+{
+    //
+    // A segment, all numbers little-endian:
+    //   "PMPSEG", version byte (1), a zero byte
+    //   u64 count, u64 heap size, u64 zero
+    //   count kind bytes, padded to 8
+    //   count 8-byte values
+    //   count + 1 u64 offsets into the heap
+    //   the heap, padded to 8
+    // A segment cut short at the end of the file, as a failed or
+    // interrupted append leaves it, is ignored by open() and cut off by
+    // the next append().
+    //
+    static const char s_segment_magic[] = "PMPSEG";
+    static const unsigned char s_segment_version = 1;
+    static const size_t s_segment_header = 32;
+
+    static inline unsigned long long load_u64(const char *p)
+    {
+        unsigned long long n = 0;
+        for (size_t b = 8; b-- > 0; )
+            n = (n << 8) | static_cast<unsigned char>(p[b]);
+        return n;
+    }
+
+    static inline void store_u64(char *p, unsigned long long n)
+    {
+        for (size_t b = 0; b < 8; ++b)
+        {
+            p[b] = static_cast<char>(n & 0xFF);
+            n >>= 8;
+        }
+    }
+
+    static inline size_t pad8(size_t n)
+    {
+        return (n + 7) & ~static_cast<size_t>(7);
+    }
+
+    static bool truncate_file(const std::string& path, size_t size)
+    {
+#ifdef _WIN32
+        HANDLE file = ::CreateFileA(path.c_str(), GENERIC_WRITE, 0, NULL,
+                                    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER pos;
+        pos.QuadPart = static_cast<LONGLONG>(size);
+        bool ok = ::SetFilePointerEx(file, pos, NULL, FILE_BEGIN) &&
+                  ::SetEndOfFile(file);
+        ::CloseHandle(file);
+        return ok;
+#else
+        return ::truncate(path.c_str(), static_cast<off_t>(size)) == 0;
+#endif
+    }
+
+    NumberStore::NumberStore() : m_size(0), m_end(0), m_open(false)
+    {
+    }
+
+    NumberStore::NumberStore(const std::string& path)
+        : m_size(0), m_end(0), m_open(false)
+    {
+        open(path);
+    }
+
+    bool NumberStore::open(const std::string& path)
+    {
+        close();
+        if (!m_file.open(path))
+        {
+            // an empty file is an empty store
+            std::ifstream fin(path.c_str(), std::ios::in | std::ios::binary);
+            if (!fin || fin.peek() != std::ifstream::traits_type::eof())
+                return false;
+            m_path = path;
+            m_open = true;
+            return true;
+        }
+
+        const char *p = m_file.data(), *end = p + m_file.size();
+        while (p < end)
+        {
+            size_t left = end - p;
+            if (std::memcmp(p, s_segment_magic, left < 6 ? left : 6) != 0 ||
+                (left > 6 && static_cast<unsigned char>(p[6]) != s_segment_version))
+            {
+                close();
+                return false;   // not a segment
+            }
+            if (left < s_segment_header)
+                break;          // cut short
+            unsigned long long count = load_u64(p + 8);
+            unsigned long long heap_size = load_u64(p + 16);
+            left -= s_segment_header;
+            size_t columns = 0;
+            if (count <= left / 17)
+                columns = pad8(static_cast<size_t>(count)) + 16 * static_cast<size_t>(count) + 8;
+            if (count > left / 17 || columns > left ||
+                heap_size > left - columns || pad8(static_cast<size_t>(heap_size)) > left - columns)
+            {
+                break;          // cut short
+            }
+
+            Segment seg;
+            seg.m_first = m_size;
+            seg.m_count = static_cast<size_t>(count);
+            seg.m_kinds = reinterpret_cast<const unsigned char *>(p + s_segment_header);
+            seg.m_values = p + s_segment_header + pad8(seg.m_count);
+            seg.m_offsets = seg.m_values + 8 * seg.m_count;
+            seg.m_heap = seg.m_offsets + 8 * (seg.m_count + 1);
+            seg.m_heap_size = static_cast<size_t>(heap_size);
+            m_segments.push_back(seg);
+            m_size += seg.m_count;
+            p = seg.m_heap + pad8(seg.m_heap_size);
+        }
+
+        m_end = p - m_file.data();
+        m_path = path;
+        m_open = true;
+        return true;
+    }
+
+    void NumberStore::close()
+    {
+        m_file.close();
+        m_path.clear();
+        m_segments.clear();
+        m_size = 0;
+        m_end = 0;
+        m_open = false;
+    }
+
+    // the segment holding element index; index becomes its place there
+    const NumberStore::Segment& NumberStore::find(size_t& index) const
+    {
+        assert(index < m_size);
+        size_t lo = 0, hi = m_segments.size();
+        while (hi - lo > 1)
+        {
+            size_t mid = (lo + hi) / 2;
+            if (m_segments[mid].m_first <= index)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        index -= m_segments[lo].m_first;
+        return m_segments[lo];
+    }
+
+    NumberStore::Kind NumberStore::kind(size_t index) const
+    {
+        const Segment& seg = find(index);
+        return static_cast<Kind>(seg.m_kinds[index]);
+    }
+
+    Number NumberStore::operator[](size_t index) const
+    {
+        const Segment& seg = find(index);
+        const char *value = seg.m_values + 8 * index;
+        switch (seg.m_kinds[index])
+        {
+        case KIND_INT64:
+            return Number(static_cast<__int64>(load_u64(value)));
+
+        case KIND_DOUBLE:
+            {
+                unsigned long long bits = load_u64(value);
+                double d;
+                std::memcpy(&d, &bits, sizeof(d));
+                return Number(d);
+            }
+
+        case KIND_HEAP:
+            {
+                const char *offsets = seg.m_offsets + 8 * index;
+                unsigned long long first = load_u64(offsets);
+                unsigned long long last = load_u64(offsets + 8);
+                if (first > last || last > seg.m_heap_size)
+                    throw std::domain_error("pmp::NumberStore: bad offsets");
+                Number num;
+                size_t size = static_cast<size_t>(last - first);
+                if (num.deserialize(seg.m_heap + first, size) != size)
+                    throw std::domain_error("pmp::NumberStore: bad offsets");
+                return num;
+            }
+
+        default:
+            throw std::domain_error("pmp::NumberStore: bad kind");
+        }
+    }
+
+    Number NumberStore::at(size_t index) const
+    {
+        if (index >= m_size)
+            throw std::out_of_range("pmp::NumberStore::at");
+        return (*this)[index];
+    }
+
+    bool NumberStore::get_int64(size_t index, __int64& value) const
+    {
+        const Segment& seg = find(index);
+        if (seg.m_kinds[index] != KIND_INT64)
+            return false;
+        value = static_cast<__int64>(load_u64(seg.m_values + 8 * index));
+        return true;
+    }
+
+    bool NumberStore::get_double(size_t index, double& value) const
+    {
+        const Segment& seg = find(index);
+        if (seg.m_kinds[index] != KIND_DOUBLE)
+            return false;
+        unsigned long long bits = load_u64(seg.m_values + 8 * index);
+        std::memcpy(&value, &bits, sizeof(value));
+        return true;
+    }
+
+    void NumberStore::slice(size_t first, size_t last, vector_type& out) const
+    {
+        if (last > m_size)
+            last = m_size;
+        if (first >= last)
+            return;
+        out.reserve(out.size() + (last - first));
+        for (size_t i = first; i < last; ++i)
+            out.push_back((*this)[i]);
+    }
+
+    // the kind of num and, for int64 and double, its 8-byte value
+    static NumberStore::Kind store_kind(const Number& num, unsigned long long& bits)
+    {
+        if (num.is_i())
+        {
+            const integer_type& i = num.get_i();
+            if (i >= (std::numeric_limits<__int64>::min)() &&
+                i <= (std::numeric_limits<__int64>::max)())
+            {
+                bits = static_cast<unsigned long long>(static_cast<__int64>(i));
+                return NumberStore::KIND_INT64;
+            }
+        }
+        else if (num.is_f())
+        {
+            const floating_type& f = num.get_f();
+            double d = f.convert_to<double>();
+            if (floating_type(d) == f)
+            {
+                std::memcpy(&bits, &d, sizeof(d));
+                return NumberStore::KIND_DOUBLE;
+            }
+        }
+        return NumberStore::KIND_HEAP;
+    }
+
+    /*static*/ bool NumberStore::append(const std::string& path, const vector_type& vec)
+    {
+        size_t count = vec.size();
+        std::string columns(s_segment_header + pad8(count) + 8 * count + 8 * (count + 1), '\0');
+        std::string heap;
+
+        char *header = &columns[0];
+        unsigned char *kinds = reinterpret_cast<unsigned char *>(header + s_segment_header);
+        char *values = header + s_segment_header + pad8(count);
+        char *offsets = values + 8 * count;
+        for (size_t i = 0; i < count; ++i)
+        {
+            unsigned long long bits = 0;
+            NumberStore::Kind k = store_kind(vec[i], bits);
+            kinds[i] = static_cast<unsigned char>(k);
+            store_u64(offsets + 8 * i, heap.size());
+            if (k == KIND_HEAP)
+                vec[i].serialize(heap);
+            else
+                store_u64(values + 8 * i, bits);
+        }
+        store_u64(offsets + 8 * count, heap.size());
+
+        std::memcpy(header, s_segment_magic, 6);
+        header[6] = static_cast<char>(s_segment_version);
+        store_u64(header + 8, count);
+        store_u64(header + 16, heap.size());
+        heap.resize(pad8(heap.size()), '\0');
+        columns += heap;
+
+        // cut off what an earlier append left half written
+        size_t end = 0;
+        {
+            NumberStore store;
+            if (store.open(path))
+            {
+                end = store.m_end;
+                bool torn = (end < store.m_file.size());
+                store.close();
+                if (torn && !truncate_file(path, end))
+                    return false;
+            }
+            else
+            {
+                std::ifstream fin(path.c_str(), std::ios::in | std::ios::binary);
+                if (fin)
+                    return false;   // not a store
+            }
+        }
+
+        std::ofstream fout(path.c_str(), std::ios::out | std::ios::binary | std::ios::app);
+        if (!fout)
+            return false;
+        fout.write(columns.data(), columns.size());
+        fout.close();
+        if (fout.fail())
+        {
+            truncate_file(path, end);
+            return false;
+        }
+        return true;
+    }
+
+    bool NumberStore::append(const vector_type& vec)
+    {
+        if (!m_open)
+            return false;
+        std::string path = m_path;
+        m_file.close();     // the file grows under the mapping
+        bool ok = append(path, vec);
+        return open(path) && ok;
+    }
+} // namespace pmp
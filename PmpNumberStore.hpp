@@ -0,0 +1,91 @@
+/////////////////////////////////////////////////////////////////////////////
+// NumberStore --- memory-mapped columnar store of numbers
+// See file "ReadMe.txt" and "License.txt".
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef PMPNUMBERSTORE_HPP_
+#define PMPNUMBERSTORE_HPP_
+
+#include "PmpNumber.hpp"
+#include "PmpNumberReader.hpp"  // for pmp::MappedFile
+
+namespace pmp
+{
+    //
+    // pmp::NumberStore
+    //
+    // A file of segments, each written by one append().  A segment holds
+    // its numbers in columns: a kind byte each, an 8-byte value each (an
+    // int64, the bits of a double, or unused), count + 1 offsets into a
+    // heap, and the heap of serialize()d values that fit neither int64 nor
+    // double exactly.  Opening maps the file and reads only the segment
+    // headers; elements are decoded when they are asked for.
+    //
+    class NumberStore
+    {
+    public:
+        enum Kind
+        {
+            KIND_INT64, KIND_DOUBLE, KIND_HEAP
+        };
+
+        NumberStore();
+        explicit NumberStore(const std::string& path);
+
+        // false if the file cannot be mapped or is not a store; a segment
+        // cut short at the end is left out
+        bool open(const std::string& path);
+        void close();
+        bool is_open() const            { return m_open; }
+
+        size_t size() const             { return m_size; }
+        size_t segment_count() const    { return m_segments.size(); }
+
+        Kind kind(size_t index) const;
+        Number operator[](size_t index) const;
+        Number at(size_t index) const;  // throws std::out_of_range
+
+        // the raw value of an int64 or double element; false for others
+        bool get_int64(size_t index, __int64& value) const;
+        bool get_double(size_t index, double& value) const;
+
+        // appends elements [first, last) to out
+        void slice(size_t first, size_t last, vector_type& out) const;
+
+        // writes vec as a new segment at the end of the file, creating it
+        // if need be; false, with the file as it was, if the file is not a
+        // store or the write fails
+        static bool append(const std::string& path, const vector_type& vec);
+        // the same for the open store, which is then mapped again
+        bool append(const vector_type& vec);
+
+    protected:
+        struct Segment
+        {
+            size_t                  m_first;    // index of the first element
+            size_t                  m_count;
+            const unsigned char *   m_kinds;
+            const char *            m_values;
+            const char *            m_offsets;
+            const char *            m_heap;
+            size_t                  m_heap_size;
+        };
+
+        MappedFile              m_file;
+        std::string             m_path;
+        std::vector<Segment>    m_segments;
+        size_t                  m_size;
+        size_t                  m_end;      // the bytes of whole segments
+        bool                    m_open;
+
+        const Segment& find(size_t& index) const;
+
+    private:
+        NumberStore(const NumberStore&);
+        NumberStore& operator=(const NumberStore&);
+    }; // class NumberStore
+} // namespace pmp
+
+/////////////////////////////////////////////////////////////////////////////
+
+#endif  // ndef PMPNUMBERSTORE_HPP_
@@ -7,3 +7,4 @@ rm -f *.user
 rm -f *.filters
 rm -fR Debug/
 rm -fR Release/
+rm -f *.so
@@ -1 +1,4 @@
 #include "PmpNumber.hpp"
+#include "PmpNumberReader.hpp"
+#include "PmpNumberStore.hpp"
+#include "PmpNumberC.h"